@@ -0,0 +1,231 @@
+#include "lib/core.hpp"
+#include "lib/data/buffer.hpp"
+#include "lib/data/floatbuffer.hpp"
+#include "lib/data/resolution.hpp"
+#include "lib/data/cameraview.hpp"
+#include "lib/data/scene.hpp"
+#include "lib/data/aov.hpp"
+#include "lib/render/shader.hpp"
+#include "lib/render/aa.hpp"
+#include "lib/render/render.hpp"
+#include "lib/util/argparser.hpp"
+#include "lib/util/bench.hpp"
+
+using namespace std;
+
+const u32 RAYS = 1024;
+
+string filter = "";
+
+auto report(const string & name, const bench::BenchFn & fn, const bool fixed = false) -> void {
+    if(name.find(filter) != string::npos) {
+        cout << bench::run(name, fn, fixed).json() << endl;
+    }
+}
+
+/*
+ * Rays from random points around target. A fraction hit of them point at
+ * target and the rest point directly away from it, so they miss.
+ */
+auto rays(const Vec & target, const f32 hit) -> vector<Ray> {
+    vector<Ray> out;
+    rng::seed(bench::SEED);
+    for(u32 r = 0; r < RAYS; r++) {
+        const Vec origin = target + f32(5) * glm::normalize(vec::rand() + Vec(0, 0, 0.001));
+        const Vec dir    = target - origin;
+        out.push_back(Ray(origin, frand() < hit ? dir : -dir));
+    }
+    return out;
+}
+
+auto bodies() -> void {
+
+    const vector<pair<Body, Vec>> tests = {
+        make_pair(body::sphere(vec::zero, 1, material::mirror), vec::zero),
+        make_pair(body::plane(vec::zero, Vec(0, 1, 0), material::mirror), vec::zero),
+        make_pair(body::triangle(Vec(-1, -1, 0), Vec(1, -1, 0), Vec(0, 1, 0), material::mirror), Vec(0, -1.0 / 3.0, 0)),
+        make_pair(body::quad(Vec(-1, -1, 0), Vec(-1, 1, 0), Vec(1, -1, 0), material::mirror), vec::zero)
+    };
+
+    for(const pair<Body, Vec> & test : tests) {
+        for(const u32 hit : { 0, 50, 100 }) {
+
+            const Body & b       = test.first;
+            const vector<Ray> rs = rays(test.second, hit / 100.0);
+
+            report("body/" + b.type + "/hit-" + to_string(hit), [&](u64 iterations) -> u64 {
+                Intersection i;
+                for(u64 n = 0; n < iterations; n++) {
+                    if(b.intersects(rs[n % RAYS], body::EPSILON, FLT_MAX, i)) {
+                        bench::consume(i.t);
+                    }
+                }
+                return iterations;
+            });
+        }
+    }
+}
+
+auto shaders(const Scene & scene, const Camera & camera) -> void {
+
+    vector<Ray> rs;
+    rng::seed(bench::SEED);
+    for(u32 r = 0; r < RAYS; r++) {
+        rs.push_back(Ray(camera, frand(), frand()));
+    }
+
+    for(const Shader * s : shader::shaders) {
+
+        const Shader & shade = *s;
+        auto op = [&]() {
+            for(const Ray & ray : rs) {
+                bench::consume(shade(ray, scene, 1));
+            }
+        };
+        const u64 perOp = bench::traced(op);
+
+        report("shader/" + shade.name + "/" + scene.name, [&](u64 iterations) -> u64 {
+            for(u64 n = 0; n < iterations; n++) {
+                op();
+            }
+            return perOp * iterations;
+        });
+    }
+}
+
+auto aliases(const Scene & scene, const Camera & camera) -> void {
+
+    const Tile tile(0, 0, 16, 16);
+
+    for(const AA * a : aa::aliases) {
+
+        FloatBuffer buffer(tile.x1, tile.y1);
+        AOVs aovs;
+        const Job job(camera, scene, shader::normal, *a, buffer, aovs);
+        const Kernel fn = kernel::get(shader::normal, *a);
+
+        auto op = [&]() { fn(job, tile); };
+        const u64 perOp = bench::traced(op);
+
+        report("aa/" + a->name + "/16x16", [&](u64 iterations) -> u64 {
+            for(u64 n = 0; n < iterations; n++) {
+                op();
+            }
+            bench::consume(buffer.get(0, 0));
+            return perOp * iterations;
+        });
+    }
+}
+
+auto colors() -> void {
+    report("color/convert", [&](u64 iterations) -> u64 {
+        for(u64 n = 0; n < iterations; n++) {
+            const f32 f = f32(n % 1024) / 1024;
+            bench::consume(Color(Vec(f, 1 - f, f * f)).g);
+        }
+        return 0;
+    });
+}
+
+auto outputs() -> void {
+
+    FloatBuffer image(256, 256);
+    image.map([](const Vec &, u32 x, u32 y, const FloatBuffer & b) -> Vec {
+        return Vec(f32(x) / b.width, f32(y) / b.height, f32(0.2));
+    });
+    const Buffer buffer = image.buffer();
+
+    for(const string format : { "bmp", "ppm" }) {
+        report("buffer/" + format + "/256x256", [&](u64 iterations) -> u64 {
+            for(u64 n = 0; n < iterations; n++) {
+                buffer.out(format, "rayn-bench." + format);
+            }
+            return 0;
+        });
+        remove(("rayn-bench." + format).c_str());
+    }
+}
+
+auto scenes(const CameraView & view) -> void {
+
+    for(const string & name : scene::names()) {
+    for(const Resolution res : { Resolution(100, 50), Resolution(200, 100) }) {
+
+        const Scene & scene  = *scene::get(name);
+        const Camera camera  = view.camera(90, res.aspect);
+        auto op = [&]() {
+            AOVs aovs;
+            render(res, camera, scene, shader::phong, aa::centered, aovs);
+        };
+        const u64 perOp = bench::traced(op);
+
+        report("scene/" + scene.name + "/phong/" + to_string(res.width) + "x" + to_string(res.height), [&](u64) -> u64 {
+            op();
+            return perOp;
+        }, true);
+    }}
+}
+
+/*
+ * Build and render each procedural scene at growing sizes, to see how
+ * throughput scales with the number of primitives.
+ */
+auto scaling(const CameraView & view) -> void {
+
+    const Resolution res(100, 50);
+    const Camera camera = view.camera(90, res.aspect);
+
+    for(const string & base : scene::names(true)) {
+    for(const u32 size : { 100, 1000, 10000 }) {
+
+        // Lights only cost anything when shading with shadow rays
+        const Shader & shade = equal(base, "many-lights") ? shader::phong : shader::normal;
+        const string name    = base + ":" + to_string(size);
+        const string build   = "scale/" + name + "/build";
+        const string render  = "scale/" + name + "/" + shade.name + "/" + to_string(res.width) + "x" + to_string(res.height);
+        if(build.find(filter) == string::npos && render.find(filter) == string::npos) {
+            continue;
+        }
+
+        report(build, [&](u64 iterations) -> u64 {
+            for(u64 n = 0; n < iterations; n++) {
+                arena::Scope scope(make_shared<Arena>());
+                bench::consume(scene::factory(name)->build(name)->bodies.size());
+            }
+            return 0;
+        });
+
+        const Scene & scene = *scene::get(name);
+        auto op = [&]() {
+            AOVs aovs;
+            ::render(res, camera, scene, shade, aa::none, aovs);
+        };
+        const u64 perOp = bench::traced(op);
+
+        report(render, [&](u64) -> u64 {
+            op();
+            return perOp;
+        }, true);
+    }}
+}
+
+auto main(const i32 argc, const i8 * argv[]) -> i32 {
+
+    ArgParser parser("rayn-bench", "Rayn micro and macro benchmarks, reported as JSON lines\n");
+    parser.arg([&](i32 n, const char** args) -> i32 {
+        filter = string(args[n]);
+        return 1;
+    }, "--filter", "-f", "only run benchmarks whose name contains filter");
+    parser.parse(argc, argv);
+
+    const CameraView view(Vec(0,0,0), Vec(0,0,-1), Vec(0,1,0));
+    const Camera camera = view.camera(90, 2);
+
+    bodies();
+    shaders(*scene::get("spheres-and-planes"), camera);
+    aliases(*scene::get("spheres-and-planes"), camera);
+    colors();
+    outputs();
+    scenes(view);
+    scaling(view);
+}
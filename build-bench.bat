@@ -0,0 +1 @@
+g++ -O3 -I . -std=c++11 -o rayn-bench .\bench.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+g++ -O3 -I . -std=c++11 -o rayn-regress .\regress.cpp
\ No newline at end of file
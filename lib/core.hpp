@@ -47,6 +47,41 @@ typedef glm::mat3 Mat;
 
 bool DEBUG = false;
 
+/*
+ * Per thread random number generator (xorshift32). The renderer reseeds it
+ * from the pixel coordinates before sampling each pixel so that images do
+ * not depend on how pixels were split between threads.
+ */
+namespace rng {
+
+    /// Global seed mixed into every pixel's seed (--seed)
+    u32 SEED = 0;
+
+    thread_local u32 state = 2463534242u;
+
+    auto seed(const u32 s) -> void {
+        state = s ? s : 2463534242u;
+    }
+
+    auto next() -> u32 {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    /* Mix pixel coordinates into a well distributed seed. */
+    auto hash(const u32 x, const u32 y, const u32 s = 0) -> u32 {
+        u32 h = x * 0x8da6b343u ^ y * 0xd8163841u ^ s * 0xcb1ab31fu;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+}
+
 namespace std {
 
     const f64 PI  =3.141592653589793238463;
@@ -83,7 +118,7 @@ namespace std {
     }
 
     auto frand() -> f32 {
-        return (f32)(rand()) / (f32)(RAND_MAX);
+        return (f32)(rng::next() >> 8) / (f32)(1 << 24);
     }
 
     template <typename T>
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "lib/data/floatbuffer.hpp"
+
+using namespace std;
+
+namespace aov {
+
+    /// Channel indices
+    const u32 DEPTH  = 0;
+    const u32 NORMAL = 1;
+    const u32 ALBEDO = 2;
+    const u32 ID     = 3;
+    const u32 COUNT  = 4;
+
+    const vector<string> NAMES = { "depth", "normal", "albedo", "id" };
+
+    /// Depth recorded for pixels whose every sample escapes the scene
+    const f32 FAR = 1e6;
+
+    auto index(const string & name) -> u32 {
+        for(u32 ch = 0; ch < COUNT; ch++) {
+            if(equal(name, NAMES[ch])) {
+                return ch;
+            }
+        }
+        return COUNT;
+    }
+
+    auto albedo(const Ray & ray, const Intersection & i) -> Vec {
+        return vec::cclamp(i.material->diff * texture::lookup(ray, i) + i.material->refl);
+    }
+
+    /*
+     * Insert the channel name before the file extension,
+     * eg. render.bmp -> render.depth.bmp
+     */
+    auto path(const string & out, const string & name, const string & format) -> string {
+        const usize dot   = out.find_last_of('.');
+        const usize slash = out.find_last_of("/\\");
+        if(dot == string::npos || (slash != string::npos && dot < slash)) {
+            return out + "." + name + "." + format;
+        }
+        return out.substr(0, dot) + "." + name + out.substr(dot);
+    }
+}
+
+/*
+ * Running sum of the primary hits of all samples taken for one pixel.
+ * Depth is summed over hits only, so samples that miss on a silhouette
+ * don't drag the average towards FAR.
+ */
+class AOVSample {
+
+    public:
+        Vec depth;
+        Vec normal;
+        Vec albedo;
+        u32 id;
+        u32 count;
+        u32 hits;
+
+        AOVSample() : depth(vec::zero), normal(vec::zero), albedo(vec::zero), id(0), count(0), hits(0) {}
+
+        auto hit(const Ray & ray, const Intersection & i) -> void {
+            if(!hits) {
+                id = i.id + 1;
+            }
+            depth  += Vec(i.t, i.t, i.t);
+            normal += i.normal;
+            albedo += aov::albedo(ray, i);
+            count++;
+            hits++;
+        }
+
+        auto miss(const Ray & ray) -> void {
+            normal -= ray.direction;
+            albedo += Vec(1, 1, 1);
+            count++;
+        }
+};
+
+/*
+ * Arbitrary output variables. Each enabled channel is a FloatBuffer of raw
+ * values filled from the same primary hits used to render the beauty image,
+ * and is only encoded for display when written out.
+ */
+class AOVs {
+
+    public:
+        vector<FloatBuffer> channels;
+
+        AOVs() : channels(aov::COUNT) {}
+
+        AOVs(const vector<string> & names, const u32 w, const u32 h) : channels(aov::COUNT) {
+            for(const string & name : names) {
+                enable(name, w, h);
+            }
+        }
+
+        auto enable(const string & name, const u32 w, const u32 h) -> void {
+            const u32 ch = aov::index(name);
+            if(ch < aov::COUNT && !enabled(ch)) {
+                channels[ch] = FloatBuffer(w, h);
+            }
+        }
+
+        auto enabled(const u32 ch) const -> bool {
+            return channels[ch].width > 0;
+        }
+
+        auto any() const -> bool {
+            for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                if(enabled(ch)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        auto get(const u32 ch) const -> const FloatBuffer & {
+            return channels[ch];
+        }
+
+        auto set(const u32 x, const u32 y, const AOVSample & s) -> void {
+            if(!s.count) {
+                return;
+            }
+            const f32 k = 1.0 / s.count;
+            const Vec depth = s.hits ? s.depth * f32(1.0 / s.hits) : Vec(aov::FAR, aov::FAR, aov::FAR);
+            if(enabled(aov::DEPTH))  channels[aov::DEPTH].set(x, y, depth);
+            if(enabled(aov::NORMAL)) channels[aov::NORMAL].set(x, y, glm::normalize(s.normal));
+            if(enabled(aov::ALBEDO)) channels[aov::ALBEDO].set(x, y, s.albedo * k);
+            if(enabled(aov::ID))     channels[aov::ID].set(x, y, Vec(s.id, s.id, s.id));
+        }
+
+        /* Encode a channel's raw values for an 8-bit image. */
+        auto encode(const u32 ch) const -> FloatBuffer {
+
+            FloatBuffer out = channels[ch];
+            f32 far = FLT_MIN;
+
+            if(ch == aov::DEPTH) {
+                for(const Vec & d : out.data) {
+                    if(d.x < aov::FAR) {
+                        far = max(far, d.x);
+                    }
+                }
+            }
+            out.map([&](const Vec & v, u32, u32, const FloatBuffer &) -> Vec {
+                switch(ch) {
+                    case aov::DEPTH:
+                        return v.x < aov::FAR ? v / far : Vec(1, 1, 1);
+                    case aov::NORMAL:
+                        return f32(0.5) * (v + Vec(1, 1, 1));
+                    case aov::ID: {
+                        const u32 h = u32(v.x) * 2654435761u;
+                        return v.x > 0
+                            ? Vec((h & 0xFF) / 255.0, ((h >> 8) & 0xFF) / 255.0, ((h >> 16) & 0xFF) / 255.0)
+                            : vec::zero;
+                    }
+                    default:
+                        return v;
+                }
+            });
+            return out;
+        }
+
+        /* Write each named channel next to the beauty image. */
+        auto out(const vector<string> & names, const string & format, const string & path) const -> void {
+            for(const string & name : names) {
+                const u32 ch = aov::index(name);
+                if(ch < aov::COUNT && enabled(ch)) {
+                    encode(ch).out(format, aov::path(path, name, format));
+                }
+            }
+        }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "lib/core.hpp"
+
+using namespace std;
+
+/* An axis aligned box, empty until grown. */
+class Bounds {
+
+    public:
+        Vec lo;
+        Vec hi;
+
+        Bounds() : lo(Vec(FLT_MAX)), hi(Vec(-FLT_MAX)) {}
+
+        Bounds(const Vec & l, const Vec & h) : lo(l), hi(h) {}
+
+        auto grow(const Vec & p) -> Bounds & {
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+            return *this;
+        }
+
+        auto grow(const Bounds & b) -> Bounds & {
+            lo = glm::min(lo, b.lo);
+            hi = glm::max(hi, b.hi);
+            return *this;
+        }
+
+        auto center() const -> Vec {
+            return (lo + hi) * f32(0.5);
+        }
+
+        auto extent() const -> Vec {
+            return hi - lo;
+        }
+
+        /* Surface area, zero when empty. */
+        auto area() const -> f32 {
+            const Vec e = extent();
+            return e.x < 0 || e.y < 0 || e.z < 0 ? 0 : 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+
+        /* Whether the box is finite, unlike those of planes. */
+        auto bounded() const -> bool {
+            return lo.x > -FLT_MAX && lo.y > -FLT_MAX && lo.z > -FLT_MAX
+                && hi.x <  FLT_MAX && hi.y <  FLT_MAX && hi.z <  FLT_MAX;
+        }
+};
+
+namespace bounds {
+
+    /// Bounds of bodies that extend without end
+    const Bounds everywhere(Vec(-FLT_MAX), Vec(FLT_MAX));
+}
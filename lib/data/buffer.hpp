@@ -1,8 +1,10 @@
 #pragma once
 
 #include <pthread.h>
+#include <cstring>
 #include "lib/core.hpp"
 #include "lib/data/color.hpp"
+#include "lib/util/memory.hpp"
 
 #define poolSize 32
 
@@ -18,7 +20,7 @@ class Buffer {
     public:
         u32 width;
         u32 height;
-        vector<Color> data;
+        vector<Color, memory::Tracked<Color, memory::FRAMEBUFFERS>> data;
 
         Buffer() {}
 
@@ -109,4 +111,44 @@ class Buffer {
             bmp->close();
         }
 
-};
\ No newline at end of file
+};
+
+namespace buffer {
+
+    /* Read a 24-bit uncompressed bmp, such as those written by Buffer::bmp. */
+    auto bmp(const string & path) -> Buffer {
+
+        ifstream fs(path, ios::binary | ios::in);
+        if(!fs) {
+            fail("Could not open " + path + ".");
+        }
+
+        u8 header[54];
+        fs.read((i8*)(header), 54);
+
+        u32 offset, width, height;
+        u16 bits;
+        memcpy(&offset, header + 10, 4);
+        memcpy(&width,  header + 18, 4);
+        memcpy(&height, header + 22, 4);
+        memcpy(&bits,   header + 28, 2);
+
+        if(!fs || header[0] != 'B' || header[1] != 'M' || bits != 24) {
+            fail(path + " is not a 24-bit bmp.");
+        }
+
+        Buffer b(width, height);
+        const u32 padding = (4 - (width * 3) % 4) % 4;
+        u8 data[3];
+
+        fs.seekg(offset);
+        for(u32 y = 0; y < height; y++) {
+            for(u32 x = 0; x < width; x++) {
+                fs.read((i8*)(data), 3);
+                b.set(x, y, Color(i32(data[2]), i32(data[1]), i32(data[0])));
+            }
+            fs.ignore(padding);
+        }
+        return b;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "lib/core.hpp"
+#include "lib/data/buffer.hpp"
+
+using namespace std;
+
+class FloatBuffer;
+
+typedef function<Vec(const Vec &, u32, u32, const FloatBuffer &)> FloatBufferMapper;
+
+/// One channel of a FloatBuffer on its own, for filters that work plane by plane
+typedef vector<f32, memory::Tracked<f32, memory::FRAMEBUFFERS>> Plane;
+
+/*
+ * A linear (pre-gamma) floating point framebuffer. Rendering accumulates into
+ * a FloatBuffer so that post-process stages like the denoiser can work on
+ * unclamped values before the image is quantized into a Buffer for output.
+ */
+class FloatBuffer {
+
+    public:
+        u32 width;
+        u32 height;
+        vector<Vec, memory::Tracked<Vec, memory::FRAMEBUFFERS>> data;
+
+        FloatBuffer() : width(0), height(0) {}
+
+        FloatBuffer(const u32 w, const u32 h) :
+            width(w),
+            height(h),
+            data(w * h, vec::zero)
+        {}
+
+        auto get(const u32 x, const u32 y) const -> const Vec & {
+            return data[y * width + x];
+        }
+
+        auto set(const u32 x, const u32 y, const Vec & v) -> const Vec & {
+            return (data[y * width + x] = v);
+        }
+
+        auto map(const FloatBufferMapper & fn) -> void {
+            for(u32 y = 0; y < height; y++) {
+            for(u32 x = 0; x < width;  x++) {
+                set(x, y, fn(get(x, y), x, y, *this));
+            }}
+        }
+
+        /* Quantize into an 8-bit buffer, applying gamma correction. */
+        auto buffer() const -> Buffer {
+            Buffer out(width, height);
+            for(usize i = 0; i < data.size(); i++) {
+                out.data[i] = Color(vec::cclamp(data[i]));
+            }
+            return out;
+        }
+
+        auto out(const string & format, const string & path) const -> void {
+            buffer().out(format, path);
+        }
+};
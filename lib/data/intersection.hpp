@@ -8,17 +8,32 @@ class Intersection {
         f32 t;
         Vec point;
         Vec normal;
-        Material material;
+        const Material * material;
+        u32 id;
+        f32 u;
+        f32 v;
+        f32 scale;
 
-    Intersection() {}
+    Intersection() : material(nullptr), id(0), u(0), v(0), scale(1) {}
 
-    Intersection(const f32 t, const Vec & p, const Vec & n, const Material & m) :
+    Intersection(const f32 t, const Vec & p, const Vec & n, const Material * m) :
         t(t),
         point(p),
         normal(glm::normalize(n)),
-        material(m)
+        material(m),
+        id(0),
+        u(0),
+        v(0),
+        scale(1)
     {}
 
+    /* Texture coordinates of the hit, with scale world units to one uv unit. */
+    auto uv(const f32 tu, const f32 tv, const f32 s) -> void {
+        u     = tu;
+        v     = tv;
+        scale = s;
+    }
+
     auto str() const -> string {
         return "ray(" + to_string(t) + ") = " + vec::str(point);
     }
@@ -1,5 +1,11 @@
 #pragma once
 
+class Texture;
+
+/*
+ * Textured materials multiply their ambient and diffuse colors by their
+ * texture where it is hit.
+ */
 class Material {
 
     public:
@@ -11,10 +17,12 @@ class Material {
         f32 specpow;
         f32 fuzz;
 
-        Material() {}
+        const Texture * texture;
+
+        Material() : texture(nullptr) {}
 
-        Material(const Vec & a, const Vec & d, const Vec & s, const Vec & r, const u32 p, const f32 f) :
-            amb(a), diff(d), spec(s), refl(r), specpow(p), fuzz(f)
+        Material(const Vec & a, const Vec & d, const Vec & s, const Vec & r, const u32 p, const f32 f, const Texture * t = nullptr) :
+            amb(a), diff(d), spec(s), refl(r), specpow(p), fuzz(f), texture(t)
         {}
 
         auto str() const -> string {
@@ -26,8 +34,8 @@ namespace material {
 
     const f32 AMBIENT = 0.1;
 
-    auto scatterLambertian(const Vec & albedo) -> Material {
-        return Material(albedo / f32(4), albedo, Vec(0.1, 0.1, 0.1), vec::zero, 2, 0.2);
+    auto scatterLambertian(const Vec & albedo, const Texture * texture = nullptr) -> Material {
+        return Material(albedo / f32(4), albedo, Vec(0.1, 0.1, 0.1), vec::zero, 2, 0.2, texture);
     }
 
     auto scatterMetal(const Vec & albedo, f32 fuzz) -> Material {
@@ -1,21 +1,32 @@
 #pragma once
 
+/*
+ * Rays are the axes of cones, width across at their origin and widening
+ * by spread per unit of t, to tell how much of a surface a ray stands for
+ * wherever it hits. Textures are filtered over that footprint.
+ */
 class Ray {
 
     public:
         Vec origin;
         Vec direction;
+        f32 width;
+        f32 spread;
 
-        Ray() {}
+        Ray() : width(0), spread(0) {}
 
-        Ray(const Vec & o, const Vec & d) :
+        Ray(const Vec & o, const Vec & d, const f32 w = 0, const f32 s = 0) :
             origin(o),
-            direction(glm::normalize(d))
+            direction(glm::normalize(d)),
+            width(w),
+            spread(s)
         {}
 
-        Ray(const Camera & c, const f32 u, const f32 v) :
+        Ray(const Camera & c, const f32 u, const f32 v, const f32 s = 0) :
             origin(c.origin),
-            direction((c.llc + u * c.hrz + v * c.vrt) - c.origin)
+            direction((c.llc + u * c.hrz + v * c.vrt) - c.origin),
+            width(0),
+            spread(s)
         {}
 
         auto at(const f32 t) const -> const Vec {
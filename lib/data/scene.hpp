@@ -1,93 +1,273 @@
 # pragma once
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "lib/render/light.hpp"
 #include "lib/render/body.hpp"
+#include "lib/render/bvh.hpp"
+#include "lib/render/texture.hpp"
+#include "lib/util/numa.hpp"
 
 using namespace std;
 
 class Scene;
+class SceneFactory;
 
-namespace scene { vector<Scene*> scenes; }
+namespace scene { vector<SceneFactory*> factories; }
 
+/*
+ * Scenes are immutable once built and shared by handle. The world body
+ * searches a BVH over the scene's own bodies, so scenes are never copied. A scene
+ * built by scene::get owns the arena its bodies were allocated from, which
+ * is declared first so it is freed last, in one step. The vectors of bodies
+ * and lights are charged to their memory tags for as long as the scene lives.
+ */
 class Scene {
 
     public:
+        shared_ptr<Arena> memory;
         vector<Body>  bodies;
         vector<Light> lights;
+        WideBVH       bvh;
         Body          world;
         string        name;
 
-        Scene(const string & n, const vector<Body> & b, const vector<Light> & l) :
-            name(n),
-            bodies(b),
-            lights(l),
-            world(body::aggregate(bodies))
+        Scene(const string & n, vector<Body> b, vector<Light> l) :
+            memory(arena::current),
+            bodies(move(b)),
+            lights(move(l)),
+            bvh(bodies),
+            world(bvh.body()),
+            name(n)
         {
-            scene::scenes.push_back(this);
+            memory::add(memory::GEOMETRY, bodies.capacity() * sizeof(Body));
+            memory::add(memory::LIGHTS, lights.capacity() * sizeof(Light));
+        }
+
+        ~Scene() {
+            memory::remove(memory::GEOMETRY, bodies.capacity() * sizeof(Body));
+            memory::remove(memory::LIGHTS, lights.capacity() * sizeof(Light));
+        }
+
+        Scene(const Scene &) = delete;
+        auto operator=(const Scene &) -> Scene & = delete;
+
+        /* Number and extent of the bodies, to tell what a scene of the same name looked like apart. */
+        auto fingerprint() const -> string {
+            return to_string(bodies.size()) + " " + vec::str(bvh.bounds.lo) + vec::str(bvh.bounds.hi);
+        }
+
+        /* Find the closest hit along ray, sampled for the time spent tracing for --stats. */
+        auto intersects(const Ray & ray, const f32 min, const f32 max, Intersection & i) const -> bool {
+            stats::Sampled timer(stats::TRACE);
+            return world.intersects(ray, min, max, i);
+        }
+};
+
+typedef function<shared_ptr<const Scene>(const string &)> SceneBuilder;
+
+/*
+ * A named recipe for a scene. Registering a factory costs nothing; the
+ * scene is only built the first time it is asked for with scene::get.
+ * Sized factories are procedural and take a size and seed in their name,
+ * eg. random-spheres:1000:7.
+ */
+class SceneFactory {
+
+    public:
+        string name;
+        SceneBuilder build;
+        bool sized;
+
+        SceneFactory(const string & n, const SceneBuilder & b, const bool s = false) : name(n), build(b), sized(s) {
+            scene::factories.push_back(this);
         }
 };
 
 namespace scene {
 
-    auto get(const string & name) -> const Scene {
-        for(const Scene* scene: scenes) {
-            if(equal(name, (*scene).name)) {
-                return *scene;
+    /// Size and seed of procedural scenes named without them
+    const u32 SIZE = 1000;
+    const u32 SEED = 1;
+
+    mutex lock;
+    map<string, shared_ptr<const Scene>> built;
+
+    /* Split a name like random-spheres:1000:7 into its base name, size and seed. */
+    auto parse(const string & name, string & base, u32 & size, u32 & seed) -> bool {
+        regex rgx(R"(^([^:]+)(?::(\d+)(?::(\d+))?)?$)");
+        smatch matches;
+        if(!regex_match(name, matches, rgx)) {
+            return false;
+        }
+        base = matches[1];
+        size = matches[2].matched ? stoi(string(matches[2])) : SIZE;
+        seed = matches[3].matched ? stoi(string(matches[3])) : SEED;
+        return true;
+    }
+
+    auto size(const string & name) -> u32 {
+        string base; u32 n, s;
+        parse(name, base, n, s);
+        return n;
+    }
+
+    auto seed(const string & name) -> u32 {
+        string base; u32 n, s;
+        parse(name, base, n, s);
+        return s;
+    }
+
+    auto factory(const string & name) -> const SceneFactory * {
+        string base; u32 n, s;
+        if(!parse(name, base, n, s)) {
+            return nullptr;
+        }
+        for(const SceneFactory* factory : factories) {
+            if(equal(base, factory->name) && (factory->sized || equal(base, name))) {
+                return factory;
+            }
+        }
+        return nullptr;
+    }
+
+    auto exists(const string & name) -> bool {
+        return factory(name) != nullptr;
+    }
+
+    /* Names of the fixed scenes, or of the procedural ones when sized. */
+    auto names(const bool sized = false) -> vector<string> {
+        vector<string> all;
+        for(const SceneFactory* factory : factories) {
+            if(factory->sized == sized) {
+                all.push_back(factory->name);
             }
         }
-        fail(name + " is not a valid scene name.");
+        return all;
     }
 
-    const Scene scene1("scene1", vector<Body> {
-        body::plane(Vec(0,-0.5,0), Vec(0,1,0), material::fbrass),  // bottom
-        body::sphere(Vec(0,0,-1), 0.5,         material::fbrass),
-        body::sphere(Vec(1,0,-5), 0.5,         material::fbrass),
-    }, vector<Light> {
-        Light(Vec(-0.5, 2, 0), 0.2),
-        Light(Vec( 0.5, 2, 0), 0.2)
+    /* The scene called name, built on first use and shared after that. */
+    auto get(const string & name) -> shared_ptr<const Scene> {
+        lock_guard<mutex> guard(lock);
+        if(built.count(name)) {
+            return built[name];
+        }
+        const SceneFactory * factory = scene::factory(name);
+        if(!factory) {
+            fail(name + " is not a valid scene name.");
+        }
+        arena::Scope scope(make_shared<Arena>());
+        return (built[name] = factory->build(name));
+    }
+
+    /// Copies of scenes, one per NUMA node, by scene name
+    map<string, vector<shared_ptr<const Scene>>> replicas;
+
+    /*
+     * Build a copy of the scene called name on every NUMA node, each by a
+     * thread running on that node so its memory is local there. Copies
+     * are built one after another, factories may write files as they go.
+     */
+    auto replicate(const string & name) -> void {
+        const u32 n = numa::nodes().size();
+        if(n < 2) {
+            return;
+        }
+        const SceneFactory * factory = scene::factory(name);
+        if(!factory) {
+            fail(name + " is not a valid scene name.");
+        }
+        vector<shared_ptr<const Scene>> copies(n);
+        for(u32 node = 0; node < n; node++) {
+            {
+                memory::Sharing sharing;
+                thread([&, node]() {
+                    numa::enter(node);
+                    arena::Scope scope(make_shared<Arena>());
+                    copies[node] = factory->build(name);
+                }).join();
+            }
+            memory::check();
+        }
+        lock_guard<mutex> guard(lock);
+        replicas[name] = move(copies);
+    }
+
+    /*
+     * The copy of scene on the node of the calling thread, or scene itself
+     * if it has none. Replicas are all made before rendering starts, so
+     * they are looked up without locking.
+     */
+    auto local(const Scene & scene) -> const Scene & {
+        if(!numa::REPLICATE) {
+            return scene;
+        }
+        const auto found = replicas.find(scene.name);
+        return found == replicas.end() ? scene : *found->second[numa::current];
+    }
+
+    const SceneFactory scene1("scene1", [](const string & name) {
+        return make_shared<const Scene>(name, vector<Body> {
+            body::plane(Vec(0,-0.5,0), Vec(0,1,0), material::fbrass),  // bottom
+            body::sphere(Vec(0,0,-1), 0.5,         material::fbrass),
+            body::sphere(Vec(1,0,-5), 0.5,         material::fbrass),
+        }, vector<Light> {
+            Light(Vec(-0.5, 2, 0), 0.2),
+            Light(Vec( 0.5, 2, 0), 0.2)
+        });
     });
 
-    const Scene scene2("scene2", vector<Body> {
-        body::sphere(Vec( 0, -100.5, -1), 100, material::scatterLambertian(Vec(0.8, 0.8, 0))),
-        body::sphere(Vec( 0, 0, -1),      0.5, material::scatterLambertian(Vec(0.8, 0.3, 0.3))),
-        body::sphere(Vec(-1, 0, -1),      0.5, material::scatterMetal(Vec(0.8, 0.8, 0.8), 0.1)),
-        body::sphere(Vec( 1, 0, -1),      0.5, material::scatterMetal(Vec(0.8, 0.6, 0.2), 0.4))
-    }, vector<Light> {
-        Light(Vec(-0.5, 0, 0), 0.2)
+    const SceneFactory scene2("scene2", [](const string & name) {
+        return make_shared<const Scene>(name, vector<Body> {
+            body::sphere(Vec( 0, -100.5, -1), 100, material::scatterLambertian(Vec(0.8, 0.8, 0))),
+            body::sphere(Vec( 0, 0, -1),      0.5, material::scatterLambertian(Vec(0.8, 0.3, 0.3))),
+            body::sphere(Vec(-1, 0, -1),      0.5, material::scatterMetal(Vec(0.8, 0.8, 0.8), 0.1)),
+            body::sphere(Vec( 1, 0, -1),      0.5, material::scatterMetal(Vec(0.8, 0.6, 0.2), 0.4))
+        }, vector<Light> {
+            Light(Vec(-0.5, 0, 0), 0.2)
+        });
     });
 
     const f32 R = cos(PI / 4.0);
-    const Scene scene3("scene3", vector<Body> {
-        body::sphere(Vec(-R, 0, -1), R, material::scatterLambertian(Vec(0, 0, 1))),
-        body::sphere(Vec( R, 0, -1), R, material::scatterLambertian(Vec(1, 0, 0)))
-    }, vector<Light> {
-        Light(Vec(-0.5, 0.5, 0), 0.2)
+    const SceneFactory scene3("scene3", [](const string & name) {
+        return make_shared<const Scene>(name, vector<Body> {
+            body::sphere(Vec(-R, 0, -1), R, material::scatterLambertian(Vec(0, 0, 1))),
+            body::sphere(Vec( R, 0, -1), R, material::scatterLambertian(Vec(1, 0, 0)))
+        }, vector<Light> {
+            Light(Vec(-0.5, 0.5, 0), 0.2)
+        });
     });
 
     // Triforce
-    const Scene triforce("triforce", vector<Body> {
-        body::triangle(Vec(-0.5, 0, -1), Vec(-1,   -1, -1), Vec( 0,   -1, -1), material::triforce),
-        body::triangle(Vec( 0.5, 0, -1), Vec( 0,   -1, -1), Vec( 1,   -1, -1), material::triforce),
-        body::triangle(Vec( 0,   1, -1), Vec(-0.5,  0, -1), Vec( 0.5,  0, -1), material::triforce)
-    }, vector<Light> {
-        Light(Vec(0, 1, 0), 0.5)
+    const SceneFactory triforce("triforce", [](const string & name) {
+        return make_shared<const Scene>(name, vector<Body> {
+            body::triangle(Vec(-0.5, 0, -1), Vec(-1,   -1, -1), Vec( 0,   -1, -1), material::triforce),
+            body::triangle(Vec( 0.5, 0, -1), Vec( 0,   -1, -1), Vec( 1,   -1, -1), material::triforce),
+            body::triangle(Vec( 0,   1, -1), Vec(-0.5,  0, -1), Vec( 0.5,  0, -1), material::triforce)
+        }, vector<Light> {
+            Light(Vec(0, 1, 0), 0.5)
+        });
     });
 
     // Spheres and Planes
 
-    const Scene spheresAndPlanes("spheres-and-planes", vector<Body> {
-        body::plane(Vec(0,-2,0), Vec(0,1,0), material::fbrass),
-        body::sphere(Vec(-1, -1, -2), 0.4, material::scatterLambertian(Vec(1.0, 0.5, 0.0))),
-        body::sphere(Vec( 0, -1, -2), 0.4, material::scatterLambertian(Vec(0.5, 1.0, 0.0))),
-        body::sphere(Vec( 1, -1, -2), 0.4, material::scatterLambertian(Vec(  0, 0.5, 1.0))),
-        body::sphere(Vec(-1,  0, -2), 0.4, material::scatterLambertian(Vec(1.0, 0.5, 0.0))),
-        body::sphere(Vec( 0,  0, -2), 0.4, material::fbrass),
-        body::sphere(Vec( 1,  0, -2), 0.4, material::scatterLambertian(Vec(  0, 0.5, 1.0))),
-        body::sphere(Vec(-1,  1, -2), 0.4, material::scatterLambertian(Vec(1.0, 0.5, 0.0))),
-        body::sphere(Vec( 0,  1, -2), 0.4, material::scatterLambertian(Vec(0.5, 1.0, 0.0))),
-        body::sphere(Vec( 1,  1, -2), 0.4, material::scatterLambertian(Vec(  0, 0.5, 1.0))),
-    }, vector<Light> {
-        Light(Vec(0, 1, 0), 0.3)
+    const SceneFactory spheresAndPlanes("spheres-and-planes", [](const string & name) {
+        return make_shared<const Scene>(name, vector<Body> {
+            body::plane(Vec(0,-2,0), Vec(0,1,0), material::fbrass),
+            body::sphere(Vec(-1, -1, -2), 0.4, material::scatterLambertian(Vec(1.0, 0.5, 0.0))),
+            body::sphere(Vec( 0, -1, -2), 0.4, material::scatterLambertian(Vec(0.5, 1.0, 0.0))),
+            body::sphere(Vec( 1, -1, -2), 0.4, material::scatterLambertian(Vec(  0, 0.5, 1.0))),
+            body::sphere(Vec(-1,  0, -2), 0.4, material::scatterLambertian(Vec(1.0, 0.5, 0.0))),
+            body::sphere(Vec( 0,  0, -2), 0.4, material::fbrass),
+            body::sphere(Vec( 1,  0, -2), 0.4, material::scatterLambertian(Vec(  0, 0.5, 1.0))),
+            body::sphere(Vec(-1,  1, -2), 0.4, material::scatterLambertian(Vec(1.0, 0.5, 0.0))),
+            body::sphere(Vec( 0,  1, -2), 0.4, material::scatterLambertian(Vec(0.5, 1.0, 0.0))),
+            body::sphere(Vec( 1,  1, -2), 0.4, material::scatterLambertian(Vec(  0, 0.5, 1.0))),
+        }, vector<Light> {
+            Light(Vec(0, 1, 0), 0.3)
+        });
     });
 
     // Box Scene
@@ -96,76 +276,247 @@ namespace scene {
     const Vec box2_center = Vec(0.15, 0.3,  0);
     const f32 box1_angle = radians(10);
     const f32 box2_angle = radians(60);
-    const Mat box1_rotate(
-         cos(box1_angle), 0, sin(box1_angle),
-         0,               1, 0,
-        -sin(box1_angle), 0, cos(box1_angle)
-    );
-    const Mat box2_rotate(
-         cos(box2_angle), 0, sin(box2_angle),
-         0,               1, 0,
-        -sin(box2_angle), 0, cos(box2_angle)
-    );
+    auto rotateY(const f32 angle) -> Mat {
+        return Mat(
+             cos(angle), 0, sin(angle),
+             0,          1, 0,
+            -sin(angle), 0, cos(angle)
+        );
+    }
 
     auto box1_transform(Vec v) -> Vec {
         v -= box1_center;
-        v =  box1_rotate * v;
+        v =  rotateY(box1_angle) * v;
         v += box1_center + Vec(0, -0.5, -0.7);
         return v;
     }
 
     auto box2_transform(Vec v) -> Vec {
         v -= box2_center;
-        v =  box2_rotate * v;
+        v =  rotateY(box2_angle) * v;
         v += box2_center + Vec(-0.35, -0.5, -0.8);
         return v;
     }
 
-    const Vec b1f1v1 = box1_transform(Vec(0,   0,    0.15));
-    const Vec b1f1v2 = box1_transform(Vec(0,   0.3,  0.15));
-    const Vec b1f1v3 = box1_transform(Vec(0.3, 0,    0.15));
+    const SceneFactory boxScene("box-scene", [](const string & name) {
+
+        const Vec b1f1v1 = box1_transform(Vec(0,   0,    0.15));
+        const Vec b1f1v2 = box1_transform(Vec(0,   0.3,  0.15));
+        const Vec b1f1v3 = box1_transform(Vec(0.3, 0,    0.15));
+
+        const Vec b1f2v1 = box1_transform(Vec(0,   0.3,  0.15));
+        const Vec b1f2v2 = box1_transform(Vec(0,   0.3, -0.15));
+        const Vec b1f2v3 = box1_transform(Vec(0.3, 0.3,  0.15));
+
+        const Vec b1f3v1 = box1_transform(Vec(0.3, 0,    0.15));
+        const Vec b1f3v2 = box1_transform(Vec(0.3, 0.3,  0.15));
+        const Vec b1f3v3 = box1_transform(Vec(0.3, 0,   -0.15));
+
+        const Vec b2f1v1 = box2_transform(Vec(0,   0,    0.15));
+        const Vec b2f1v2 = box2_transform(Vec(0,   0.6,  0.15));
+        const Vec b2f1v3 = box2_transform(Vec(0.3, 0,    0.15));
+
+        const Vec b2f2v1 = box2_transform(Vec(0,   0.6,  0.15));
+        const Vec b2f2v2 = box2_transform(Vec(0,   0.6, -0.15));
+        const Vec b2f2v3 = box2_transform(Vec(0.3, 0.6,  0.15));
 
-    const Vec b1f2v1 = box1_transform(Vec(0,   0.3,  0.15));
-    const Vec b1f2v2 = box1_transform(Vec(0,   0.3, -0.15));
-    const Vec b1f2v3 = box1_transform(Vec(0.3, 0.3,  0.15));
+        const Vec b2f3v1 = box2_transform(Vec(0.3, 0,    0.15));
+        const Vec b2f3v2 = box2_transform(Vec(0.3, 0.6,  0.15));
+        const Vec b2f3v3 = box2_transform(Vec(0.3, 0,   -0.15));
 
-    const Vec b1f3v1 = box1_transform(Vec(0.3, 0,    0.15));
-    const Vec b1f3v2 = box1_transform(Vec(0.3, 0.3,  0.15));
-    const Vec b1f3v3 = box1_transform(Vec(0.3, 0,   -0.15));
+        return make_shared<const Scene>(name, vector<Body> {
 
-    const Vec b2f1v1 = box2_transform(Vec(0,   0,    0.15));
-    const Vec b2f1v2 = box2_transform(Vec(0,   0.6,  0.15));
-    const Vec b2f1v3 = box2_transform(Vec(0.3, 0,    0.15));
+            // Walls
+            body::plane(Vec( 0,   0,  -1), Vec( 0,  0, 1), material::scatterLambertian(Vec(0.9, 0.9, 0.9))), // Back wall
+            body::plane(Vec(-0.5, 0,   0), Vec( 1,  0, 0), material::scatterLambertian(Vec(1, 0, 0))), // Left wall
+            body::plane(Vec( 0.5, 0,   0), Vec(-1,  0, 0), material::scatterLambertian(Vec(0, 1, 0))), // Right wall
+            body::plane(Vec( 0,  -0.5, 0), Vec( 0,  1, 0), material::scatterLambertian(Vec(0.9, 0.9, 0.9))), // Floor
+            body::plane(Vec( 0,   0.5, 0), Vec( 0, -1, 0), material::scatterLambertian(Vec(0.9, 0.9, 0.9))), // Cieling
 
-    const Vec b2f2v1 = box2_transform(Vec(0,   0.6,  0.15));
-    const Vec b2f2v2 = box2_transform(Vec(0,   0.6, -0.15));
-    const Vec b2f2v3 = box2_transform(Vec(0.3, 0.6,  0.15));
+            // Box1
+            body::quad(b1f1v1, b1f1v2, b1f1v3, material::scatterLambertian(Vec(1, 1, 1))),
+            body::quad(b1f2v1, b1f2v2, b1f2v3, material::scatterLambertian(Vec(1, 1, 1))),
+            body::quad(b1f3v1, b1f3v2, b1f3v3, material::scatterLambertian(Vec(1, 1, 1))),
 
-    const Vec b2f3v1 = box2_transform(Vec(0.3, 0,    0.15));
-    const Vec b2f3v2 = box2_transform(Vec(0.3, 0.6,  0.15));
-    const Vec b2f3v3 = box2_transform(Vec(0.3, 0,   -0.15));
+            // Box2
+            body::quad(b2f1v1, b2f1v2, b2f1v3, material::scatterLambertian(Vec(1, 1, 1))),
+            body::quad(b2f2v1, b2f2v2, b2f2v3, material::scatterLambertian(Vec(1, 1, 1))),
+            body::quad(b2f3v1, b2f3v2, b2f3v3, material::scatterLambertian(Vec(1, 1, 1))),
 
-    const Scene boxScene("box-scene", vector<Body> {
+            // Cieling "light"
+            body::quad(Vec(-0.1, 0.499, -0.64), Vec(-0.1, 0.499, -0.60), Vec( 0.1, 0.499, -0.64), material::cornellLight)
 
-        // Walls
-        body::plane(Vec( 0,   0,  -1), Vec( 0,  0, 1), material::scatterLambertian(Vec(0.9, 0.9, 0.9))), // Back wall
-        body::plane(Vec(-0.5, 0,   0), Vec( 1,  0, 0), material::scatterLambertian(Vec(1, 0, 0))), // Left wall
-        body::plane(Vec( 0.5, 0,   0), Vec(-1,  0, 0), material::scatterLambertian(Vec(0, 1, 0))), // Right wall
-        body::plane(Vec( 0,  -0.5, 0), Vec( 0,  1, 0), material::scatterLambertian(Vec(0.9, 0.9, 0.9))), // Floor
-        body::plane(Vec( 0,   0.5, 0), Vec( 0, -1, 0), material::scatterLambertian(Vec(0.9, 0.9, 0.9))), // Cieling
+        }, light::area(Light(Vec(0, 0.40, -0.62), Vec(0.3, 0.25, 0.15)), 64, 0.02));
+    });
+
+    // Procedural Scenes
+
+    /* Deterministic random numbers for building procedural scenes. */
+    class Random {
+
+        public:
+            u32 state;
+
+            Random(const u32 seed) : state(rng::hash(seed, 0, 0x5eed) | 1) {}
 
-        // Box1
-        body::quad(b1f1v1, b1f1v2, b1f1v3, material::scatterLambertian(Vec(1, 1, 1))),
-        body::quad(b1f2v1, b1f2v2, b1f2v3, material::scatterLambertian(Vec(1, 1, 1))),
-        body::quad(b1f3v1, b1f3v2, b1f3v3, material::scatterLambertian(Vec(1, 1, 1))),
+            auto next() -> f32 {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                return (f32)(state >> 8) / (f32)(1 << 24);
+            }
 
-        // Box2
-        body::quad(b2f1v1, b2f1v2, b2f1v3, material::scatterLambertian(Vec(1, 1, 1))),
-        body::quad(b2f2v1, b2f2v2, b2f2v3, material::scatterLambertian(Vec(1, 1, 1))),
-        body::quad(b2f3v1, b2f3v2, b2f3v3, material::scatterLambertian(Vec(1, 1, 1))),
+            auto range(const f32 a, const f32 b) -> f32 {
+                return a + (b - a) * next();
+            }
 
-        // Cieling "light"
-        body::quad(Vec(-0.1, 0.499, -0.64), Vec(-0.1, 0.499, -0.60), Vec( 0.1, 0.499, -0.64), material::cornellLight)
+            /* A point in the volume in front of the default camera. */
+            auto point() -> Vec {
+                return Vec(range(-4, 4), range(-1.5, 1.5), range(-9, -3));
+            }
+
+            auto material() -> Material {
+                const Vec albedo(range(0.1, 1), range(0.1, 1), range(0.1, 1));
+                return next() < 0.8
+                    ? material::scatterLambertian(albedo)
+                    : material::scatterMetal(albedo, range(0, 0.5));
+            }
+    };
 
-    }, light::area(Light(Vec(0, 0.40, -0.62), Vec(0.3, 0.25, 0.15)), 64, 0.02));
-}
\ No newline at end of file
+    /// Volume the random scenes are spread over
+    const f32 VOLUME = 8 * 3 * 6;
+
+    const vector<Light> LIGHTS = {
+        Light(Vec(-2, 3, 0), 0.3),
+        Light(Vec( 2, 3, 0), 0.3)
+    };
+
+    /* Six outward facing quads of a cube with half size h around c. */
+    auto cube(const Vec & c, const f32 h, const Material & m) -> vector<Body> {
+        const Vec axes[] = { Vec(1,0,0), Vec(0,1,0), Vec(0,0,1) };
+        vector<Body> faces;
+        for(u32 k = 0; k < 3; k++) {
+        for(const f32 side : { 1.0f, -1.0f }) {
+            const Vec n  = side * axes[k];
+            const Vec a  = axes[(k + 1) % 3];
+            const Vec b  = glm::cross(a, n);
+            const Vec v1 = c + h * (n - a - b);
+            faces.push_back(body::quad(v1, v1 + 2 * h * a, v1 + 2 * h * b, m));
+        }}
+        return faces;
+    }
+
+    // N spheres of random size and material
+    const SceneFactory randomSpheres("random-spheres", [](const string & name) {
+        Random random(seed(name));
+        const u32 n    = size(name);
+        const f32 scale = 0.3 * cbrt(VOLUME / n);
+        vector<Body> bodies;
+        bodies.reserve(n + 1);
+        bodies.push_back(body::plane(Vec(0, -2, 0), Vec(0, 1, 0), material::fbrass));
+        for(u32 k = 0; k < n; k++) {
+            const Vec c = random.point();
+            bodies.push_back(body::sphere(c, random.range(0.5, 1) * scale, random.material()));
+        }
+        return make_shared<const Scene>(name, move(bodies), LIGHTS);
+    }, true);
+
+    // N small randomly oriented triangles
+    const SceneFactory triangleSoup("triangle-soup", [](const string & name) {
+        Random random(seed(name));
+        const u32 n    = size(name);
+        const f32 scale = 0.6 * cbrt(VOLUME / n);
+        vector<Body> bodies;
+        bodies.reserve(n);
+        for(u32 k = 0; k < n; k++) {
+            const Vec c = random.point();
+            const Vec v1 = c + scale * Vec(random.range(-1, 1), random.range(-1, 1), random.range(-1, 1));
+            const Vec v2 = c + scale * Vec(random.range(-1, 1), random.range(-1, 1), random.range(-1, 1));
+            const Vec v3 = c + scale * Vec(random.range(-1, 1), random.range(-1, 1), random.range(-1, 1));
+            bodies.push_back(body::triangle(v1, v2, v3, random.material()));
+        }
+        return make_shared<const Scene>(name, move(bodies), LIGHTS);
+    }, true);
+
+    // N instances of one cube on a square grid, sharing its quads
+    const SceneFactory instancedGrid("instanced-grid", [](const string & name) {
+        Random random(seed(name));
+        const u32 n    = size(name);
+        const u32 side = ceil(sqrt(f32(n)));
+        const shared_ptr<const vector<Body>> mesh = make_shared<const vector<Body>>(
+            cube(vec::zero, 0.3, material::scatterLambertian(Vec(0.9, 0.9, 0.9)))
+        );
+        vector<Body> bodies;
+        bodies.reserve(n + 1);
+        bodies.push_back(body::plane(Vec(0, -0.5, 0), Vec(0, 1, 0), material::fbrass));
+        for(u32 k = 0; k < n; k++) {
+            const f32 x = f32(k % side) - side / 2.0;
+            const f32 z = -2 - f32(k / side);
+            bodies.push_back(body::instance(mesh, Vec(x, random.range(-0.2, 0.2), z)));
+        }
+        return make_shared<const Scene>(name, move(bodies), LIGHTS);
+    }, true);
+
+    /// Distinct textures of the textured scenes, and the texels along their sides
+    const u32 PATTERNS = 16;
+    const u32 PATTERN_SIZE = 512;
+
+    /*
+     * Texture k of the textured scenes, a checkerboard of two random colors
+     * ruled with fine lines that only mip-mapping keeps from aliasing. It
+     * is generated into the temp directory the first time it is needed.
+     */
+    auto pattern(const u32 k) -> const Texture * {
+        const string path = texture::scratch("pattern-" + to_string(k) + "-" + to_string(PATTERN_SIZE));
+        if(!ifstream(path)) {
+            Random random(k);
+            const Vec a(random.range(0.3, 1), random.range(0.3, 1), random.range(0.3, 1));
+            const Vec b = a * random.range(0.2, 0.6);
+            Buffer image(PATTERN_SIZE, PATTERN_SIZE);
+            image.map([&](const Color &, u32 x, u32 y, const Buffer &) {
+                const bool line  = x % 16 == 0 || y % 16 == 0;
+                const bool check = (x / 64 + y / 64) % 2;
+                return Color(line ? Vec(0.05, 0.05, 0.05) : check ? a : b);
+            });
+            texture::convert(image, path);
+        }
+        return texture::open(path);
+    }
+
+    // N spheres over a floor, textured with a few large textures
+    const SceneFactory texturedSpheres("textured-spheres", [](const string & name) {
+        Random random(seed(name));
+        const u32 n    = size(name);
+        const f32 scale = 0.3 * cbrt(VOLUME / n);
+        vector<const Texture *> textures;
+        for(u32 k = 0; k <= PATTERNS; k++) {
+            textures.push_back(pattern(k));
+        }
+        vector<Body> bodies;
+        bodies.reserve(n + 1);
+        bodies.push_back(body::plane(Vec(0, -2, 0), Vec(0, 1, 0), material::scatterLambertian(Vec(0.8, 0.8, 0.8), textures[PATTERNS])));
+        for(u32 k = 0; k < n; k++) {
+            const Vec c = random.point();
+            const f32 r = random.range(0.5, 1) * scale;
+            bodies.push_back(body::sphere(c, r, material::scatterLambertian(Vec(0.9, 0.9, 0.9), textures[k % PATTERNS])));
+        }
+        return make_shared<const Scene>(name, move(bodies), LIGHTS);
+    }, true);
+
+    // Spheres and planes lit by N point lights
+    const SceneFactory manyLights("many-lights", [](const string & name) {
+        Random random(seed(name));
+        const u32 n = size(name);
+        vector<Light> lights;
+        lights.reserve(n);
+        for(u32 k = 0; k < n; k++) {
+            lights.push_back(Light(Vec(random.range(-4, 4), random.range(1, 3), random.range(-6, 0)), 0.6 / n));
+        }
+        vector<Body> bodies = { body::plane(Vec(0, -2, 0), Vec(0, 1, 0), material::fbrass) };
+        for(i32 x = -1; x <= 1; x++) {
+        for(i32 y = -1; y <= 1; y++) {
+            bodies.push_back(body::sphere(Vec(x, y, -2), 0.4, random.material()));
+        }}
+        return make_shared<const Scene>(name, move(bodies), move(lights));
+    }, true);
+}
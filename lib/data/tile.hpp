@@ -0,0 +1,62 @@
+#pragma once
+
+#include "lib/core.hpp"
+
+using namespace std;
+
+/* A rectangular block of pixels [x0, x1) x [y0, y1) rendered as one unit. */
+class Tile {
+
+    public:
+        u32 x0;
+        u32 y0;
+        u32 x1;
+        u32 y1;
+
+        Tile() : x0(0), y0(0), x1(0), y1(0) {}
+
+        Tile(const u32 x0, const u32 y0, const u32 x1, const u32 y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+        auto pixels() const -> u32 {
+            return (x1 - x0) * (y1 - y0);
+        }
+};
+
+namespace tile {
+
+    const u32 SIZE = 32;
+
+    /* Cover a w x h image with tiles of at most size x size pixels. */
+    auto split(const u32 w, const u32 h, const u32 size = SIZE) -> vector<Tile> {
+        vector<Tile> tiles;
+        for(u32 y = 0; y < h; y += size) {
+        for(u32 x = 0; x < w; x += size) {
+            tiles.push_back(Tile(x, y, min(x + size, w), min(y + size, h)));
+        }}
+        return tiles;
+    }
+
+    /* The parts of tiles inside region, dropping the tiles outside it. */
+    auto clip(const vector<Tile> & tiles, const Tile & region) -> vector<Tile> {
+        vector<Tile> clipped;
+        for(const Tile & t : tiles) {
+            const Tile c(max(t.x0, region.x0), max(t.y0, region.y0), min(t.x1, region.x1), min(t.y1, region.y1));
+            if(c.x0 < c.x1 && c.y0 < c.y1) {
+                clipped.push_back(c);
+            }
+        }
+        return clipped;
+    }
+
+    /*
+     * Every nth tile starting from tile i. Interleaving the shards spreads
+     * expensive parts of the image evenly over them.
+     */
+    auto shard(const vector<Tile> & tiles, const u32 i, const u32 n) -> vector<Tile> {
+        vector<Tile> mine;
+        for(u32 t = i; t < tiles.size(); t += n) {
+            mine.push_back(tiles[t]);
+        }
+        return mine;
+    }
+}
@@ -1,13 +1,15 @@
 #pragma once
 
+#include <mutex>
+
 using namespace std;
 
-typedef function<Color(
-    const Camera &,
-    const Scene &,
-    const Shader &,
+typedef function<Vec(f32 u, f32 v)> SampleFn;
+
+typedef function<Vec(
     u32 x, u32 y,
-    const Buffer &
+    const FloatBuffer &,
+    const SampleFn &
 )> AliasFn;
 
 class AA;
@@ -19,25 +21,16 @@ class AA {
     public:
         string name;
         AliasFn alias;
+        u32 samples;
 
-        AA(const string & n, const AliasFn & s) : name(n), alias(s) {
+        AA(const string & n, const AliasFn & s, const u32 k = 1) : name(n), alias(s), samples(k) {
             aa::aliases.push_back(this);
         }
-
-        auto sample(
-            const Camera & c,
-            const Scene & s,
-            const Shader & h
-        ) const -> BufferMapper {
-            return [&](const Color & color, u32 x, u32 y, const Buffer & b) -> Color {
-                return alias(c, s, h, x, y, b);
-            };
-        }
 };
 
 namespace aa {
 
-    auto get(const string & name) -> const AA {
+    auto get(const string & name) -> const AA & {
         for(const AA* aa: aliases) {
             if(equal(name, (*aa).name)) {
                 return *aa;
@@ -46,98 +39,101 @@ namespace aa {
         fail(name + " is not a valid AA algorithm.");
     }
 
-    auto progress(const u32 x, const u32 y, const u32 height) -> void {
-        if(x == 0) {
+    mutex progressLock;
 
-            const f32 p = f32(y) / f32(height - 1);
-            const u32 w = 60;
-            const u32 i = p * w;
+    auto progress(const u32 done, const u32 total) -> void {
 
-            debug << "[";
-            for (u32 j = 0; j < w; j++) {
-                debug << (j <= i ? "|" : " ");
-            }
-            debug << "] " << u32(p * 100.0) << "%\r";
-            debug.flush();
+        lock_guard<mutex> lock(progressLock);
+
+        const f32 p = f32(done) / f32(total);
+        const u32 w = 60;
+        const u32 i = p * w;
+
+        debug << "[";
+        for (u32 j = 0; j < w; j++) {
+            debug << (j <= i ? "|" : " ");
         }
+        debug << "] " << u32(p * 100.0) << "%\r";
+        debug.flush();
     }
 
-    const AA none("none", [](
-        const Camera & camera,
-        const Scene & scene,
-        const Shader & shade,
-        u32 x, u32 y,
-        const Buffer & b
-    ) -> Color {
-        progress(x, y, b.height);
-        const f32 u = f32(x) / f32(b.width);
-        const f32 v = f32(y) / f32(b.height);
-        return Color(shade(Ray(camera, u, v), scene, 1));
-    });
-
-    const AA centered("centered", [](
-        const Camera & camera,
-        const Scene & scene,
-        const Shader & shade,
-        u32 x, u32 y,
-        const Buffer & b
-    ) -> Color {
-        progress(x, y, b.height);
-        const f32 u = f32(x + 0.5) / f32(b.width);
-        const f32 v = f32(y + 0.5) / f32(b.height);
-        return Color(shade(Ray(camera, u, v), scene, 1));
-    });
-
-    auto SSAA(u32 times) -> const AA {
-
-        const f32 step = 1.0 / times;
-        const f32 K    = 1.0 / (times * times);
-        const f32 f_1  = step * 0.1;
-        const f32 f_3  = step * 0.3;
-        const f32 f_7  = step * 0.7;
-        const f32 f_9  = step * 0.9;
-
-        return AA(to_string(times) + "xSSAA", [=](
-            const Camera & camera,
-            const Scene & scene,
-            const Shader & shade,
-            u32 x, u32 y,
-            const Buffer & b
-        ) -> Color {
-            progress(x, y, b.height);
+    /*
+     * Each algorithm is a type with a static alias template so the render
+     * kernel can be specialized on it and inline the sampling loop. The AA
+     * instances below wrap the same code for type-erased use. SAMPLES is
+     * how many times alias calls sample per pixel.
+     */
+    struct None {
+        static const u32 SAMPLES = 1;
+        template<typename F>
+        static auto alias(u32 x, u32 y, const FloatBuffer & b, const F & sample) -> Vec {
+            const f32 u = f32(x) / f32(b.width);
+            const f32 v = f32(y) / f32(b.height);
+            return sample(u, v);
+        }
+    };
+    const AA none("none", None::alias<SampleFn>);
+
+    struct Centered {
+        static const u32 SAMPLES = 1;
+        template<typename F>
+        static auto alias(u32 x, u32 y, const FloatBuffer & b, const F & sample) -> Vec {
+            const f32 u = f32(x + 0.5) / f32(b.width);
+            const f32 v = f32(y + 0.5) / f32(b.height);
+            return sample(u, v);
+        }
+    };
+    const AA centered("centered", Centered::alias<SampleFn>);
+
+    template<u32 times>
+    struct SSAA {
+        static const u32 SAMPLES = 4 * times * times;
+        template<typename F>
+        static auto alias(u32 x, u32 y, const FloatBuffer & b, const F & sample) -> Vec {
+
+            const f32 step = 1.0 / times;
+            const f32 K    = 1.0 / (times * times);
+            const f32 f_1  = step * 0.1;
+            const f32 f_3  = step * 0.3;
+            const f32 f_7  = step * 0.7;
+            const f32 f_9  = step * 0.9;
+
             Vec s(0,0,0);
             f32 u;
             f32 v;
 
-            for(f32 yoff = 0; yoff < 1; yoff += step) {
-            for(f32 xoff = 0; xoff < 1; xoff += step) {
+            for(u32 j = 0; j < times; j++) {
+            for(u32 k = 0; k < times; k++) {
+
+                const f32 xoff = k * step;
+                const f32 yoff = j * step;
 
                 u = f32(x + xoff + f_7) / f32(b.width);
                 v = f32(y + yoff + f_1) / f32(b.height);
-                const Vec s1 = shade(Ray(camera, u, v), scene, 1);
+                const Vec s1 = sample(u, v);
 
                 u = f32(x + xoff + f_1) / f32(b.width);
                 v = f32(y + yoff + f_3) / f32(b.height);
-                const Vec s2 = shade(Ray(camera, u, v), scene, 1);
+                const Vec s2 = sample(u, v);
 
                 u = f32(x + xoff + f_9) / f32(b.width);
                 v = f32(y + yoff + f_7) / f32(b.height);
-                const Vec s3 = shade(Ray(camera, u, v), scene, 1);
+                const Vec s3 = sample(u, v);
 
                 u = f32(x + xoff + f_3) / f32(b.width);
                 v = f32(y + yoff + f_9) / f32(b.height);
-                const Vec s4 = shade(Ray(camera, u, v), scene, 1);
+                const Vec s4 = sample(u, v);
 
                 s += (s1 + s2 + s3 + s4) * f32(1.0 / 4.0);
             }}
-            return Color(s * K);
-        });
-    }
+            return s * K;
+        }
+    };
 
-    const AA SSAAx4  = SSAA(1);
-    const AA SSAAx8  = SSAA(2);
-    const AA SSAAx16 = SSAA(4);
-    const AA SSAAx32 = SSAA(8);
-    const AA SSAAx64 = SSAA(16);
+    const AA SSAAx4 ("1xSSAA",  SSAA<1>::alias<SampleFn>, SSAA<1>::SAMPLES);
+    const AA SSAAx8 ("2xSSAA",  SSAA<2>::alias<SampleFn>, SSAA<2>::SAMPLES);
+    const AA SSAAx16("4xSSAA",  SSAA<4>::alias<SampleFn>, SSAA<4>::SAMPLES);
+    const AA SSAAx32("8xSSAA",  SSAA<8>::alias<SampleFn>, SSAA<8>::SAMPLES);
+    const AA SSAAx64("16xSSAA", SSAA<16>::alias<SampleFn>, SSAA<16>::SAMPLES);
 
-}
\ No newline at end of file
+}
@@ -1,24 +1,64 @@
 #pragma once
 
+#include <array>
+#include <memory>
 #include "lib/data/ray.hpp"
 #include "lib/data/intersection.hpp"
 #include "lib/data/material.hpp"
+#include "lib/data/bounds.hpp"
+#include "lib/util/stats.hpp"
+#include "lib/util/arena.hpp"
 
 using namespace std;
 
 typedef function<bool(const Ray &, f32, f32, Intersection &)> IntersectionFn;
 
+/*
+ * Flat convex bodies also keep their corners, in order around their
+ * outline, so they can be rasterized. Other bodies have no sides. Bodies
+ * are bounded by their corners, unless they say otherwise, and bodies
+ * without corners are taken to be everywhere.
+ */
 class Body {
     public:
         string         type;
         IntersectionFn intersects;
-
-        Body(const string & t, const IntersectionFn & i) : type(t), intersects(i) {}
+        array<Vec, 4>  corners;
+        u32            sides;
+        Bounds         bounds;
+
+        Body(const string & t, const IntersectionFn & i, initializer_list<Vec> c = {}) :
+            type(t), intersects(i), sides(c.size()), bounds(c.size() ? Bounds() : bounds::everywhere)
+        {
+            copy(c.begin(), c.end(), corners.begin());
+            for(const Vec & corner : c) {
+                bounds.grow(corner);
+            }
+        }
 };
 
 namespace body {
 
     const f32 EPSILON   = 0.001;
+    const f32 PI        = 3.14159265358979;
+
+    /*
+     * Keep an intersection closure in the current arena, leaving only a
+     * pointer to it in the IntersectionFn. A pointer fits in the inline
+     * storage of a std::function so bodies never allocate on the heap.
+     */
+    template<typename F>
+    auto pooled(const F & fn) -> IntersectionFn {
+        const F * f = arena::make<F>(fn);
+        return [f](const Ray & ray, f32 min, f32 max, Intersection & i) -> bool {
+            return (*f)(ray, min, max, i);
+        };
+    }
+
+    /* Keep a copy of material in the current arena, where it stays put for hits to point at. */
+    auto kept(const Material & material) -> const Material * {
+        return arena::make<Material>(material);
+    }
 
     auto aggregate(const vector<Body> & bodies) -> Body {
         return Body("aggregate", [&](const Ray & ray, f32 min, f32 max, Intersection & i) {
@@ -27,19 +67,32 @@ namespace body {
             f32 closest      = max;
             bool intersected = false;
 
-            for(Body const & body : bodies) {
-                if(body.intersects(ray, min, closest, tmp)) {
+            for(u32 id = 0; id < bodies.size(); id++) {
+                if(bodies[id].intersects(ray, min, closest, tmp)) {
                     intersected = true;
                     closest     = tmp.t;
                     i           = tmp;
+                    i.id        = id;
                 }
             }
             return intersected;
         });
     }
 
-    auto sphere(const Vec & center, const f32 radius, const Material & material) -> Body {
-        return Body("sphere", [=](const Ray & ray, f32 min, f32 max, Intersection & i) {
+    /*
+     * Texture coordinates of a sphere wrap u around the y axis and run v
+     * from pole to pole. Only worked out for textured materials.
+     */
+    auto spherical(Intersection & i, const Vec & center, const f32 radius) -> void {
+        const Vec n = (i.point - center) / radius;
+        i.uv(0.5 + atan2(n.z, n.x) / (2 * PI), acos(min(max(-n.y, -1.0f), 1.0f)) / PI, PI * radius * sqrt(2.0f));
+    }
+
+    auto sphere(const Vec & center, const f32 radius, const Material & m) -> Body {
+        const Material * material = kept(m);
+        Body sphere("sphere", pooled([=](const Ray & ray, f32 min, f32 max, Intersection & i) {
+
+            stats::count(stats::SPHERE);
 
             const Vec oc = ray.origin - center;
             const f32 a  = glm::dot(ray.direction, ray.direction);
@@ -53,23 +106,38 @@ namespace body {
                 t = (-b - sqrt(d)) / (2.0 * a);
                 if(t > min && t < max) {
                     i = Intersection(t, ray.at(t), ray.at(t) - center, material);
+                    if(material->texture) {
+                        spherical(i, center, radius);
+                    }
                     return true;
                 }
                 t = (-b + sqrt(d)) / (2.0 * a);
                 if(t > min && t < max) {
                     i = Intersection(t, ray.at(t), ray.at(t) - center, material);
+                    if(material->texture) {
+                        spherical(i, center, radius);
+                    }
                     return true;
                 }
             }
             return false;
-        });
+        }));
+        sphere.bounds = Bounds(center - Vec(radius), center + Vec(radius));
+        return sphere;
     }
 
-    auto plane(const Vec & point, const Vec & n, const Material & material) -> Body {
+    auto plane(const Vec & point, const Vec & n, const Material & m) -> Body {
+        const Material * material = kept(m);
 
         const Vec normal = glm::normalize(n);
 
-        return Body("plane", [=](const Ray & ray, f32 min, f32 max, Intersection & i) {
+        // Textures repeat every world unit along two axes in the plane
+        const Vec tu = glm::normalize(glm::cross(normal, fabs(normal.y) < 0.9 ? Vec(0, 1, 0) : Vec(1, 0, 0)));
+        const Vec tv = glm::cross(normal, tu);
+
+        return Body("plane", pooled([=](const Ray & ray, f32 min, f32 max, Intersection & i) {
+
+            stats::count(stats::PLANE);
 
             const f32 t =
                 glm::dot(point - ray.origin, normal) /
@@ -77,19 +145,26 @@ namespace body {
 
             if(t > min && t < max) {
                 i = Intersection(t, ray.at(t), normal, material);
+                if(material->texture) {
+                    i.uv(glm::dot(i.point - point, tu), glm::dot(i.point - point, tv), 1);
+                }
                 return true;
             }
             return false;
-        });
+        }));
     }
 
-    auto triangle(const Vec & v1, const Vec & v2, const Vec & v3, const Material & material) -> Body {
+    auto triangle(const Vec & v1, const Vec & v2, const Vec & v3, const Material & m) -> Body {
+        const Material * material = kept(m);
 
         const Vec edge1  = v2 - v1;
         const Vec edge2  = v3 - v1;
         const Vec normal = glm::cross(edge1, edge2);
+        const f32 scale  = sqrt(glm::length(normal));
+
+        return Body("triangle", pooled([=](const Ray & ray, f32 min, f32 max, Intersection & i) {
 
-        return Body("triangle", [=](const Ray & ray, f32 min, f32 max, Intersection & i) {
+            stats::count(stats::TRIANGLE);
 
             const Vec a = glm::cross(ray.direction, edge2);
             const Vec b = ray.origin - v1;
@@ -103,15 +178,19 @@ namespace body {
                 const f32 t = glm::dot(edge2, c) / d;
                 if(t > min && t < max) {
                     i = Intersection(t, ray.at(t), normal, material);
+                    if(material->texture) {
+                        i.uv(u, v, scale);
+                    }
                     return true;
                 }
             }
             return false;
-        });
+        }), { v1, v2, v3 });
 
     }
 
-    auto quad(const Vec & v1, const Vec & v2, const Vec & v3, const Material & material) -> Body {
+    auto quad(const Vec & v1, const Vec & v2, const Vec & v3, const Material & m) -> Body {
+        const Material * material = kept(m);
 
         const Vec s1 = v2 - v1;
         const Vec s2 = v3 - v1;
@@ -119,8 +198,11 @@ namespace body {
 
         const f32 sqrs1 = glm::dot(s1, s1);
         const f32 sqrs2 = glm::dot(s2, s2);
+        const f32 scale = sqrt(sqrt(sqrs1 * sqrs2));
+
+        Body quad("quad", pooled([=](const Ray & ray, f32 min, f32 max, Intersection & i) {
 
-        return Body("quad", [=](const Ray & ray, f32 min, f32 max, Intersection & i) {
+            stats::count(stats::QUAD);
 
             const f32 t =
                 glm::dot(v1 - ray.origin, normal) /
@@ -131,10 +213,64 @@ namespace body {
                 const Vec s3 = ray.at(t) - v1;
                 const f32 u = glm::dot(s3, s1);
                 const f32 v = glm::dot(s3, s2);
+                if(material->texture) {
+                    i.uv(u / sqrs1, v / sqrs2, scale);
+                }
                 return u >= 0 && u <= sqrs1 && v >= 0 && v <= sqrs2;
             }
             return false;
-        });
+        }));
+
+        // Hits project onto s1 and s2 within [0, |s|^2], a parallelogram
+        // whose corners solve the Gram system of s1 and s2
+        const f32 s12 = glm::dot(s1, s2);
+        const f32 det = sqrs1 * sqrs2 - s12 * s12;
+        auto corner = [&](const f32 p1, const f32 p2) -> Vec {
+            return v1 + s1 * ((sqrs2 * p1 - s12 * p2) / det) + s2 * ((sqrs1 * p2 - s12 * p1) / det);
+        };
+        if(det > 0) {
+            quad.corners = {{ corner(0, 0), corner(sqrs1, 0), corner(sqrs1, sqrs2), corner(0, sqrs2) }};
+            quad.sides   = 4;
+            quad.bounds  = Bounds();
+            for(const Vec & c : quad.corners) {
+                quad.bounds.grow(c);
+            }
+        }
+        return quad;
     }
 
-}
\ No newline at end of file
+
+    /*
+     * A translated copy of a mesh. The mesh is shared between all of its
+     * instances so only the offset is stored per instance.
+     */
+    auto instance(const shared_ptr<const vector<Body>> & mesh, const Vec & offset) -> Body {
+        Body instance("instance", pooled([=](const Ray & ray, f32 min, f32 max, Intersection & i) {
+
+            Ray local = ray;
+            local.origin = ray.origin - offset;
+
+            Intersection tmp;
+            f32 closest      = max;
+            bool intersected = false;
+
+            for(const Body & b : *mesh) {
+                if(b.intersects(local, min, closest, tmp)) {
+                    intersected = true;
+                    closest     = tmp.t;
+                    i           = tmp;
+                }
+            }
+            if(intersected) {
+                i.point += offset;
+            }
+            return intersected;
+        }));
+
+        instance.bounds = Bounds();
+        for(const Body & b : *mesh) {
+            instance.bounds.grow(b.bounds.bounded() ? Bounds(b.bounds.lo + offset, b.bounds.hi + offset) : bounds::everywhere);
+        }
+        return instance;
+    }
+}
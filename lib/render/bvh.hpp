@@ -0,0 +1,576 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include "lib/data/bounds.hpp"
+#include "lib/render/body.hpp"
+#include "lib/util/memory.hpp"
+#include "lib/util/parallel.hpp"
+#include "lib/util/stats.hpp"
+#include "lib/util/trace.hpp"
+
+using namespace std;
+
+namespace bvh {
+
+    /// Children of every node, and bodies of a leaf at most
+    const u32 WIDTH = 4;
+    const u32 LEAF  = 4;
+
+    /*
+     * Children are nodes by index or leaves, which have the top bit set,
+     * the number of their bodies in the next three and where their bodies
+     * start in the rest. Empty leaves fill unused slots.
+     */
+    const u32 LEAF_BIT = 0x80000000u;
+    const u32 COUNT_SHIFT = 28;
+    const u32 FIRST_MASK  = (1u << COUNT_SHIFT) - 1;
+    const u32 EMPTY = LEAF_BIT;
+
+    /// Nodes waiting to be visited by one traversal at most
+    const u32 STACK = 256;
+
+    /// Buckets the centers of a range are sorted into along each axis to find a split
+    const u32 BINS = 16;
+
+    /// Relative costs of visiting a node and testing a body, for the surface area heuristic
+    const f64 NODE_COST = 1;
+    const f64 BODY_COST = 1;
+
+    /// Bodies below which a subtree is built on the thread that reached it
+    const u32 TASK = 4096;
+
+    /// Depth past which ranges are halved rather than split by cost, so traversal stacks stay small
+    const u32 DEEP = 48;
+
+    /// Bodies a worker handles at a time when the top levels are split between threads
+    const u32 CHUNK = 16384;
+
+    auto leaf(const u32 first, const u32 count) -> u32 {
+        return LEAF_BIT | count << COUNT_SHIFT | first;
+    }
+
+    /* Spread the low 10 bits of x out to every third bit. */
+    auto spread(u32 x) -> u32 {
+        x &= 0x3ff;
+        x = (x | x << 16) & 0x030000ff;
+        x = (x | x <<  8) & 0x0300f00f;
+        x = (x | x <<  4) & 0x030c30c3;
+        x = (x | x <<  2) & 0x09249249;
+        return x;
+    }
+
+    /* Morton code of a point in the unit cube, 10 bits per axis interleaved. */
+    auto morton(const Vec & p) -> u32 {
+        const Vec q = glm::min(glm::max(p * f32(1023), Vec(0)), Vec(1023));
+        return spread(q.x) << 2 | spread(q.y) << 1 | spread(q.z);
+    }
+
+    /*
+     * Like parallel::each, but threads are left where they are, so a scene
+     * built on a NUMA node by --replicate is built by threads of that node.
+     */
+    auto each(const u32 count, const function<void(u32)> & fn) -> void {
+        if(count == 1) {
+            fn(0);
+            return;
+        }
+        atomic<u32> next(0);
+        auto worker = [&]() {
+            for(u32 i = next++; i < count && !memory::exceeded; i = next++) {
+                fn(i);
+            }
+        };
+        {
+            memory::Sharing sharing;
+            vector<thread> pool;
+            for(u32 t = 1; t < min(parallel::threads(), count); t++) {
+                pool.push_back(thread(worker));
+            }
+            worker();
+            for(thread & t : pool) {
+                t.join();
+            }
+        }
+        memory::check();
+    }
+
+    /* Run fn(chunk, first, last) over chunks of [0, count), across threads when wide. */
+    auto chunks(const u32 count, const bool wide, const function<void(u32, u32, u32)> & fn) -> u32 {
+        const u32 n = wide ? max((count + CHUNK - 1) / CHUNK, 1u) : 1;
+        each(n, [&](const u32 c) {
+            fn(c, u64(count) * c / n, u64(count) * (c + 1) / n);
+        });
+        return n;
+    }
+
+    /* 2^e as a float, made from its exponent bits. */
+    auto pow2(const i32 e) -> f32 {
+        const u32 bits = u32(e + 127) << 23;
+        f32 f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+}
+
+/*
+ * Node of a 4-wide BVH in 56 bytes, so it fits a cache line. Child boxes
+ * are stored per axis for all children at once, as 8-bit steps of 2^exponent
+ * from origin, rounded outward with a step to spare on either side so
+ * they always enclose what they bound.
+ */
+class WideNode {
+
+    public:
+        Vec origin;
+        i8  exponent[3];
+        u8  count;
+        u8  lo[3][bvh::WIDTH];
+        u8  hi[3][bvh::WIDTH];
+        u32 children[bvh::WIDTH];
+
+        /* Quantize the n boxes of the children into the node. */
+        auto pack(const Bounds * boxes, const u32 n) -> void {
+
+            Bounds all;
+            for(u32 k = 0; k < n; k++) {
+                all.grow(boxes[k]);
+            }
+            count = n;
+            for(u32 a = 0; a < 3; a++) {
+
+                // A step well above the float precision of the coordinates
+                const f32 extent = all.hi[a] - all.lo[a];
+                const f32 tiny   = max(max(fabs(all.lo[a]), fabs(all.hi[a])) * f32(1e-5), f32(1e-30));
+                i32 e = 0;
+                frexp(max(extent, tiny) / 253, &e);
+                e = min(max(e, -126), 127);
+
+                const f32 step = bvh::pow2(e);
+                exponent[a] = e;
+                origin[a]   = all.lo[a] - step;
+
+                for(u32 k = 0; k < bvh::WIDTH; k++) {
+                    if(k < n) {
+                        lo[a][k] = min(max(floor((boxes[k].lo[a] - origin[a]) / step) - 1, 0.0f), 255.0f);
+                        hi[a][k] = min(max(ceil ((boxes[k].hi[a] - origin[a]) / step) + 1, 0.0f), 255.0f);
+                    } else {
+                        lo[a][k] = 255;
+                        hi[a][k] = 0;
+                    }
+                }
+            }
+        }
+};
+
+/*
+ * Bounding volume hierarchy over the bounded bodies of a scene, 4 children
+ * to a node. Bodies without bounds, such as planes, are tested by every
+ * ray before the tree. Hits report the index of the body in the scene
+ * and, as when testing bodies in order, ties go to the first body.
+ *
+ * The tree is built top down with the surface area heuristic, over bodies
+ * sorted along a Morton curve so neighbours in space are neighbours in
+ * memory. Ranges of bodies are split where binning their centers says a
+ * ray is cheapest to trace, and split again, largest first, until they
+ * make the four children of a node. The root is split by all threads
+ * together, and below it every large subtree of the first levels is a
+ * task of its own.
+ */
+class WideBVH {
+
+    public:
+        class Entry {
+            public:
+                u32 code;
+                f32 t;
+        };
+
+        typedef vector<u32, memory::Tracked<u32, memory::ACCELERATION>> Ids;
+
+        const vector<Body> & bodies;
+        Ids unbounded;
+        Ids ids;
+        vector<WideNode, memory::Tracked<WideNode, memory::ACCELERATION>> nodes;
+        u32 root;
+        Bounds bounds;
+
+        WideBVH(const vector<Body> & b) : bodies(b), root(bvh::EMPTY) {
+
+            trace::Span span("acceleration build");
+            const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+            for(u32 id = 0; id < bodies.size(); id++) {
+                (bodies[id].bounds.bounded() ? ids : unbounded).push_back(id);
+            }
+            if(ids.size() > bvh::FIRST_MASK) {
+                fail("Too many bodies for one scene.");
+            }
+
+            f64 cost = 0;
+            if(!ids.empty()) {
+
+                refs.resize(ids.size());
+                Range all { 0, u32(ids.size()), Bounds(), Bounds() };
+                bvh::chunks(ids.size(), true, [&](u32, u32 first, u32 last) {
+                    for(u32 j = first; j < last; j++) {
+                        const Bounds & box = bodies[ids[j]].bounds;
+                        refs[j] = Ref { box, box.center(), ids[j], 0 };
+                    }
+                });
+                measure(all, true);
+                sort(all);
+                bounds = all.box;
+
+                // A node has two children at least and a leaf one body, so there are fewer nodes than bodies
+                nodes.resize(ids.size());
+                used    = 0;
+                workers = parallel::threads();
+                levels  = 0;
+                while(workers > 1 && 1u << 2 * levels < 4 * workers) {
+                    levels++;
+                }
+                root = build(all, 0, cost);
+                nodes.resize(used);
+                nodes.shrink_to_fit();
+
+                for(u32 j = 0; j < refs.size(); j++) {
+                    ids[j] = refs[j].id;
+                }
+                refs.clear();
+                refs.shrink_to_fit();
+                cost /= all.box.area() > 0 ? all.box.area() : 1;
+            }
+            debug << "Built a BVH of " << nodes.size() << " nodes over " << ids.size() << " bodies, "
+                << unbounded.size() << " unbounded, in "
+                << chrono::duration<f64, milli>(chrono::steady_clock::now() - start).count()
+                << " ms with a SAH cost of " << cost << endl;
+        }
+
+        WideBVH(const WideBVH &) = delete;
+        auto operator=(const WideBVH &) -> WideBVH & = delete;
+
+        auto intersects(const Ray & ray, const f32 min, const f32 max, Intersection & i) const -> bool {
+
+            Intersection tmp;
+            f32 closest = max;
+            f32 limit   = max;
+            bool hit    = false;
+
+            // Bodies hit at the same t are also tested, the first of them wins
+            auto test = [&](const u32 id) {
+                if(bodies[id].intersects(ray, min, limit, tmp) && (tmp.t < closest || (hit && id < i.id))) {
+                    i       = tmp;
+                    i.id    = id;
+                    hit     = true;
+                    closest = tmp.t;
+                    limit   = nextafter(closest, FLT_MAX);
+                }
+            };
+
+            for(const u32 id : unbounded) {
+                test(id);
+            }
+
+            const Vec inv(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+            Entry stack[bvh::STACK];
+            u32 top = 0;
+            stack[top++] = Entry { root, min };
+
+            while(top) {
+
+                const Entry entry = stack[--top];
+                if(entry.t > closest) {
+                    continue;
+                }
+                if(entry.code & bvh::LEAF_BIT) {
+                    const u32 first = entry.code & bvh::FIRST_MASK;
+                    const u32 count = (entry.code & ~bvh::LEAF_BIT) >> bvh::COUNT_SHIFT;
+                    for(u32 j = first; j < first + count; j++) {
+                        test(ids[j]);
+                    }
+                    continue;
+                }
+
+                const WideNode & node = nodes[entry.code];
+                stats::count(stats::NODES);
+
+                f32 tnear[bvh::WIDTH];
+                f32 tfar[bvh::WIDTH];
+                for(u32 k = 0; k < bvh::WIDTH; k++) {
+                    tnear[k] = min;
+                    tfar[k]  = closest;
+                }
+                for(u32 a = 0; a < 3; a++) {
+                    const f32 step = bvh::pow2(node.exponent[a]) * inv[a];
+                    const f32 base = (node.origin[a] - ray.origin[a]) * inv[a];
+                    const u8 * lo  = inv[a] >= 0 ? node.lo[a] : node.hi[a];
+                    const u8 * hi  = inv[a] >= 0 ? node.hi[a] : node.lo[a];
+                    for(u32 k = 0; k < bvh::WIDTH; k++) {
+                        tnear[k] = std::max(tnear[k], base + lo[k] * step);
+                        tfar[k]  = std::min(tfar[k],  base + hi[k] * step);
+                    }
+                }
+
+                // Push the children hit farthest first, so the nearest is visited next
+                u32 order[bvh::WIDTH];
+                u32 n = 0;
+                for(u32 k = 0; k < node.count; k++) {
+                    if(tnear[k] <= tfar[k]) {
+                        u32 at = n++;
+                        for(; at > 0 && tnear[order[at - 1]] < tnear[k]; at--) {
+                            order[at] = order[at - 1];
+                        }
+                        order[at] = k;
+                    }
+                }
+                for(u32 k = 0; k < n && top < bvh::STACK; k++) {
+                    stack[top++] = Entry { node.children[order[k]], tnear[order[k]] };
+                }
+            }
+            return hit;
+        }
+
+        /* The tree as a body, for the scene to intersect. */
+        auto body() const -> Body {
+            return Body("bvh", [this](const Ray & ray, f32 min, f32 max, Intersection & i) -> bool {
+                return intersects(ray, min, max, i);
+            });
+        }
+
+    private:
+        /* A body as the builder sees it, kept together so ranges stay in cache. */
+        class Ref {
+            public:
+                Bounds box;
+                Vec center;
+                u32 id;
+                u32 code;
+        };
+
+        /* Refs in [first, last) with their bounds and the bounds of their centers. */
+        class Range {
+            public:
+                u32 first;
+                u32 last;
+                Bounds box;
+                Bounds centers;
+
+                auto size() const -> u32 {
+                    return last - first;
+                }
+        };
+
+        class Bin {
+            public:
+                Bounds box;
+                Bounds centers;
+                u32 count;
+        };
+
+        vector<Ref, memory::Tracked<Ref, memory::ACCELERATION>> refs;
+        atomic<u32> used;
+        u32 workers;
+        u32 levels;
+
+        auto measure(Range & range, const bool wide) -> void {
+            vector<Range> parts(wide ? max((range.size() + bvh::CHUNK - 1) / bvh::CHUNK, 1u) : 1);
+            const u32 n = bvh::chunks(range.size(), wide, [&](u32 c, u32 first, u32 last) {
+                Range & part = parts[c];
+                for(u32 j = range.first + first; j < range.first + last; j++) {
+                    part.box.grow(refs[j].box);
+                    part.centers.grow(refs[j].center);
+                }
+            });
+            for(u32 c = 0; c < n; c++) {
+                range.box.grow(parts[c].box);
+                range.centers.grow(parts[c].centers);
+            }
+        }
+
+        /* Order refs along a Morton curve through the bounds of their centers. */
+        auto sort(const Range & all) -> void {
+
+            const Vec e = all.centers.extent();
+            const Vec scale(e.x > 0 ? 1 / e.x : 0, e.y > 0 ? 1 / e.y : 0, e.z > 0 ? 1 / e.z : 0);
+            const u32 n = bvh::chunks(refs.size(), true, [&](u32, u32 first, u32 last) {
+                for(u32 j = first; j < last; j++) {
+                    refs[j].code = bvh::morton((refs[j].center - all.centers.lo) * scale);
+                }
+                std::sort(refs.begin() + first, refs.begin() + last, [](const Ref & a, const Ref & b) {
+                    return a.code < b.code;
+                });
+            });
+
+            // Merge the sorted chunks pairwise, each round halving their number
+            for(u32 width = 1; width < n; width *= 2) {
+                bvh::each((n + 2 * width - 1) / (2 * width), [&](u32 k) {
+                    const u32 first  = u64(refs.size()) * min(2 * k * width, n) / n;
+                    const u32 middle = u64(refs.size()) * min((2 * k + 1) * width, n) / n;
+                    const u32 last   = u64(refs.size()) * min((2 * k + 2) * width, n) / n;
+                    inplace_merge(refs.begin() + first, refs.begin() + middle, refs.begin() + last, [](const Ref & a, const Ref & b) {
+                        return a.code < b.code;
+                    });
+                });
+            }
+        }
+
+        /*
+         * Split range in two where the surface area heuristic puts it,
+         * between bins of the centers along one of the axes. Ranges whose
+         * centers all coincide, or that are too deep, are halved.
+         */
+        auto split(const Range & range, const u32 depth, const bool wide, Range & left, Range & right) -> void {
+
+            const Vec e = range.centers.extent();
+            f32 scale[3];
+            for(u32 a = 0; a < 3; a++) {
+                scale[a] = e[a] > 0 ? bvh::BINS * f32(0.9999) / e[a] : 0;
+            }
+            auto bin = [&](const Ref & ref, const u32 a) -> u32 {
+                return min(u32((ref.center[a] - range.centers.lo[a]) * scale[a]), bvh::BINS - 1);
+            };
+
+            vector<array<Bin, 3 * bvh::BINS>> parts(wide ? max((range.size() + bvh::CHUNK - 1) / bvh::CHUNK, 1u) : 1);
+            const u32 n = bvh::chunks(range.size(), wide, [&](u32 c, u32 first, u32 last) {
+                array<Bin, 3 * bvh::BINS> & bins = parts[c];
+                bins.fill(Bin { Bounds(), Bounds(), 0 });
+                for(u32 j = range.first + first; j < range.first + last; j++) {
+                    for(u32 a = 0; a < 3; a++) {
+                        Bin & b = bins[a * bvh::BINS + bin(refs[j], a)];
+                        b.box.grow(refs[j].box);
+                        b.centers.grow(refs[j].center);
+                        b.count++;
+                    }
+                }
+            });
+            for(u32 c = 1; c < n; c++) {
+                for(u32 k = 0; k < 3 * bvh::BINS; k++) {
+                    parts[0][k].box.grow(parts[c][k].box);
+                    parts[0][k].centers.grow(parts[c][k].centers);
+                    parts[0][k].count += parts[c][k].count;
+                }
+            }
+
+            f64 best = FLT_MAX;
+            u32 axis = 3;
+            u32 cut  = 0;
+            for(u32 a = 0; a < 3 && depth < bvh::DEEP; a++) {
+                if(scale[a] == 0) {
+                    continue;
+                }
+                const Bin * bins = &parts[0][a * bvh::BINS];
+
+                // Cost of everything right of each cut, then sweep from the left
+                f64 after[bvh::BINS];
+                Bounds box;
+                u32 count = 0;
+                for(u32 k = bvh::BINS - 1; k > 0; k--) {
+                    box.grow(bins[k].box);
+                    count += bins[k].count;
+                    after[k] = count ? f64(box.area()) * count : -1;
+                }
+                box   = Bounds();
+                count = 0;
+                for(u32 k = 1; k < bvh::BINS; k++) {
+                    box.grow(bins[k - 1].box);
+                    count += bins[k - 1].count;
+                    const f64 cost = f64(box.area()) * count + after[k];
+                    if(count && after[k] >= 0 && cost < best) {
+                        best = cost;
+                        axis = a;
+                        cut  = k;
+                    }
+                }
+            }
+
+            if(axis == 3) {
+                const u32 middle = (range.first + range.last) / 2;
+                left  = Range { range.first, middle, Bounds(), Bounds() };
+                right = Range { middle, range.last, Bounds(), Bounds() };
+                measure(left,  wide);
+                measure(right, wide);
+                return;
+            }
+
+            // The bins either side of the cut already know the bounds of each half
+            const u32 middle = partition(refs.begin() + range.first, refs.begin() + range.last, [&](const Ref & ref) {
+                return bin(ref, axis) < cut;
+            }) - refs.begin();
+            left  = Range { range.first, middle, Bounds(), Bounds() };
+            right = Range { middle, range.last, Bounds(), Bounds() };
+            for(u32 k = 0; k < bvh::BINS; k++) {
+                const Bin & b = parts[0][axis * bvh::BINS + k];
+                Range & half = k < cut ? left : right;
+                half.box.grow(b.box);
+                half.centers.grow(b.centers);
+            }
+        }
+
+        /*
+         * Build the subtree of range, returning its child code and adding its
+         * share of the SAH cost, before dividing by the root's area, to cost.
+         * Children of the first levels are built by threads of their own.
+         */
+        auto build(const Range & range, const u32 depth, f64 & cost) -> u32 {
+
+            if(range.size() <= bvh::LEAF) {
+                cost += bvh::BODY_COST * range.box.area() * range.size();
+                return bvh::leaf(range.first, range.size());
+            }
+            cost += bvh::NODE_COST * range.box.area();
+
+            // Only the root is measured by all threads, below it subtrees are tasks
+            const bool wide = depth == 0 && workers > 1 && range.size() >= 2 * bvh::CHUNK;
+            Range ranges[bvh::WIDTH] = { range };
+            u32 n = 1;
+            while(n < bvh::WIDTH) {
+                u32 largest = bvh::WIDTH;
+                for(u32 k = 0; k < n; k++) {
+                    if(ranges[k].size() > bvh::LEAF && (largest == bvh::WIDTH || ranges[k].box.area() > ranges[largest].box.area())) {
+                        largest = k;
+                    }
+                }
+                if(largest == bvh::WIDTH) {
+                    break;
+                }
+                split(Range(ranges[largest]), depth, wide, ranges[largest], ranges[n]);
+                n++;
+            }
+
+            const u32 index = used++;
+            u32 children[bvh::WIDTH];
+            f64 costs[bvh::WIDTH] = {};
+            unique_ptr<memory::Sharing> sharing(depth < levels ? new memory::Sharing() : nullptr);
+            vector<thread> tasks;
+            for(u32 k = 0; k < bvh::WIDTH; k++) {
+                children[k] = bvh::EMPTY;
+                if(k >= n) {
+                    continue;
+                }
+                if(k + 1 < n && depth < levels && ranges[k].size() >= bvh::TASK) {
+                    tasks.push_back(thread([&, k]() {
+                        children[k] = build(ranges[k], depth + 1, costs[k]);
+                    }));
+                } else {
+                    children[k] = build(ranges[k], depth + 1, costs[k]);
+                }
+            }
+            for(thread & t : tasks) {
+                t.join();
+            }
+            sharing.reset();
+            memory::check();
+
+            Bounds boxes[bvh::WIDTH];
+            for(u32 k = 0; k < n; k++) {
+                boxes[k] = ranges[k].box;
+                cost += costs[k];
+            }
+            WideNode & node = nodes[index];
+            node.pack(boxes, n);
+            copy(children, children + bvh::WIDTH, node.children);
+            return index;
+        }
+};
@@ -0,0 +1,389 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include "lib/data/tile.hpp"
+#include "lib/data/aov.hpp"
+
+using namespace std;
+
+namespace checkpoint {
+
+    const string MAGIC = "RAYNCKP1";
+
+    /// Minimum seconds between writes of the checkpoint file
+    const f64 INTERVAL = 60;
+
+    auto put(ostream & fs, const u32 n) -> void {
+        fs.write((const char *) &n, sizeof(n));
+    }
+
+    auto take(istream & fs) -> u32 {
+        u32 n = 0;
+        fs.read((char *) &n, sizeof(n));
+        return n;
+    }
+
+    /* Write the pixels of tile in buffer, one row at a time. */
+    auto put(ostream & fs, const FloatBuffer & buffer, const Tile & tile) -> void {
+        for(u32 y = tile.y0; y < tile.y1; y++) {
+            fs.write((const char *) &buffer.data[y * buffer.width + tile.x0], (tile.x1 - tile.x0) * sizeof(Vec));
+        }
+    }
+
+    auto take(istream & fs, FloatBuffer & buffer, const Tile & tile) -> void {
+        for(u32 y = tile.y0; y < tile.y1; y++) {
+            fs.read((char *) &buffer.data[y * buffer.width + tile.x0], (tile.x1 - tile.x0) * sizeof(Vec));
+        }
+    }
+
+    auto copy(FloatBuffer & to, const FloatBuffer & from, const Tile & tile) -> void {
+        for(u32 y = tile.y0; y < tile.y1; y++) {
+        for(u32 x = tile.x0; x < tile.x1; x++) {
+            to.set(x, y, from.get(x, y));
+        }}
+    }
+}
+
+/*
+ * Progress of a render made of one or more passes over the same tiles. The
+ * passes are averaged into the final image, so later passes refine the
+ * result progressively. With a path set, finished tiles, the sum of the
+ * finished passes, and the AOVs are periodically written to disk so an
+ * interrupted render can be resumed from where it was. Setting stop makes
+ * the render return early, leaving the current pass unfinished.
+ */
+class Checkpoint {
+
+    public:
+        string path;
+        string key;
+        u32 passes;
+        u32 pass;
+        vector<Tile> tiles;
+        vector<u8> done;
+        FloatBuffer sum;
+        FloatBuffer current;
+        AOVs aovs;
+        mutex lock;
+        chrono::steady_clock::time_point saved;
+        const atomic<bool> * stop;
+
+        Checkpoint(
+            const string & p,
+            const string & k,
+            const u32 w,
+            const u32 h,
+            const u32 n,
+            const vector<Tile> & t,
+            const AOVs & a
+        ) :
+            path(p),
+            key(k),
+            passes(n),
+            pass(0),
+            tiles(t),
+            done(t.size(), 0),
+            sum(w, h),
+            saved(chrono::steady_clock::now()),
+            stop(nullptr)
+        {
+            if(enabled()) {
+                current = FloatBuffer(w, h);
+                for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                    if(a.enabled(ch)) {
+                        aovs.channels[ch] = FloatBuffer(w, h);
+                    }
+                }
+            }
+        }
+
+        /* Open a checkpoint file of any render, see load. */
+        Checkpoint(const string & p) : path(p), passes(0), pass(0), stop(nullptr) {}
+
+        auto enabled() const -> bool {
+            return !path.empty();
+        }
+
+        /* Indices of the tiles the current pass still has to render. */
+        auto todo() const -> vector<u32> {
+            vector<u32> t;
+            for(u32 i = 0; i < tiles.size(); i++) {
+                if(!done[i]) {
+                    t.push_back(i);
+                }
+            }
+            return t;
+        }
+
+        /* The buffer to render the current pass into, holding its finished tiles. */
+        auto buffer() const -> FloatBuffer {
+            return enabled() ? current : FloatBuffer(sum.width, sum.height);
+        }
+
+        /* Record tile t of the current pass as rendered into buffer. */
+        auto finish(const u32 t, const FloatBuffer & buffer, const AOVs & rendered) -> void {
+            lock_guard<mutex> guard(lock);
+            done[t] = 1;
+            if(!enabled()) {
+                return;
+            }
+            checkpoint::copy(current, buffer, tiles[t]);
+            for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                if(aovs.enabled(ch)) {
+                    checkpoint::copy(aovs.channels[ch], rendered.get(ch), tiles[t]);
+                }
+            }
+            if(chrono::duration<f64>(chrono::steady_clock::now() - saved).count() >= checkpoint::INTERVAL) {
+                save();
+            }
+        }
+
+        /* Add a completed pass to the sum and start the next one. */
+        auto next(const FloatBuffer & buffer) -> void {
+            lock_guard<mutex> guard(lock);
+            for(usize p = 0; p < sum.data.size(); p++) {
+                sum.data[p] += buffer.data[p];
+            }
+            pass++;
+            fill(done.begin(), done.end(), 0);
+            if(enabled()) {
+                current = FloatBuffer(sum.width, sum.height);
+            }
+        }
+
+        /* The average of all completed passes. */
+        auto image() const -> FloatBuffer {
+            FloatBuffer out = sum;
+            const f32 k = 1.0 / max(pass, u32(1));
+            for(Vec & v : out.data) {
+                v *= k;
+            }
+            return out;
+        }
+
+        /* Copy the AOVs saved with the checkpoint into rendered. */
+        auto restore(AOVs & rendered) const -> void {
+            for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                if(aovs.enabled(ch) && rendered.enabled(ch)) {
+                    rendered.channels[ch] = aovs.get(ch);
+                }
+            }
+        }
+
+        /*
+         * Write the checkpoint to a temporary file and move it over path, so
+         * being interrupted mid write never loses the previous checkpoint.
+         * Expects lock to be held.
+         */
+        auto save() -> void {
+            save(path);
+            saved = chrono::steady_clock::now();
+            debug << endl << "Checkpoint saved at pass " << pass << endl;
+        }
+
+        auto save(const string & to) const -> void {
+
+            const string tmp = to + ".tmp";
+            {
+                ofstream fs(tmp, ios::binary);
+                fs.write(checkpoint::MAGIC.data(), checkpoint::MAGIC.size());
+                checkpoint::put(fs, key.size());
+                fs.write(key.data(), key.size());
+                checkpoint::put(fs, sum.width);
+                checkpoint::put(fs, sum.height);
+                checkpoint::put(fs, passes);
+                checkpoint::put(fs, pass);
+                checkpoint::put(fs, channels());
+                checkpoint::put(fs, tiles.size());
+                for(u32 t = 0; t < tiles.size(); t++) {
+                    checkpoint::put(fs, tiles[t].x0);
+                    checkpoint::put(fs, tiles[t].y0);
+                    checkpoint::put(fs, tiles[t].x1);
+                    checkpoint::put(fs, tiles[t].y1);
+                    fs.put(done[t]);
+                }
+                for(u32 t = 0; t < tiles.size(); t++) {
+                    if(pass > 0) checkpoint::put(fs, sum, tiles[t]);
+                    if(done[t])  checkpoint::put(fs, current, tiles[t]);
+                    for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                        if(aovs.enabled(ch) && (pass > 0 || done[t])) {
+                            checkpoint::put(fs, aovs.get(ch), tiles[t]);
+                        }
+                    }
+                }
+                if(!fs) {
+                    fail("Could not write " + tmp + ".");
+                }
+            }
+            remove(to.c_str());
+            rename(tmp.c_str(), to.c_str());
+        }
+
+        /*
+         * Read the checkpoint at path, or its temporary file when
+         * interrupted while replacing it. Returns false when there is none.
+         * A checkpoint opened by path alone takes its key, size, passes and
+         * AOVs from the file; otherwise they have to match.
+         */
+        auto load() -> bool {
+
+            ifstream fs(path, ios::binary);
+            if(!fs) {
+                fs.open(path + ".tmp", ios::binary);
+            }
+            if(!fs) {
+                return false;
+            }
+
+            string magic(checkpoint::MAGIC.size(), ' ');
+            fs.read(&magic[0], magic.size());
+            if(!equal(magic, checkpoint::MAGIC)) {
+                fail(path + " is not a rayn checkpoint.");
+            }
+
+            string k(checkpoint::take(fs), ' ');
+            fs.read(&k[0], k.size());
+            const u32 w = checkpoint::take(fs);
+            const u32 h = checkpoint::take(fs);
+            const u32 n = checkpoint::take(fs);
+            pass        = checkpoint::take(fs);
+            const u32 mask = checkpoint::take(fs);
+
+            if(sum.width == 0) {
+                key     = k;
+                passes  = n;
+                sum     = FloatBuffer(w, h);
+                current = FloatBuffer(w, h);
+                for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                    if(mask & (1 << ch)) {
+                        aovs.channels[ch] = FloatBuffer(w, h);
+                    }
+                }
+            } else if(!equal(k, key) || w != sum.width || h != sum.height || n != passes || mask != channels()) {
+                fail(path + " is not a checkpoint of this render.");
+            }
+
+            // The saved tiles replace the planned ones, which depend on timing
+            tiles = vector<Tile>(checkpoint::take(fs));
+            done  = vector<u8>(tiles.size(), 0);
+            for(u32 t = 0; t < tiles.size(); t++) {
+                tiles[t].x0 = checkpoint::take(fs);
+                tiles[t].y0 = checkpoint::take(fs);
+                tiles[t].x1 = checkpoint::take(fs);
+                tiles[t].y1 = checkpoint::take(fs);
+                done[t] = fs.get();
+                if(tiles[t].x0 > tiles[t].x1 || tiles[t].y0 > tiles[t].y1 || tiles[t].x1 > w || tiles[t].y1 > h) {
+                    fail(path + " has tiles outside of its image.");
+                }
+            }
+            for(u32 t = 0; t < tiles.size(); t++) {
+                if(pass > 0) checkpoint::take(fs, sum, tiles[t]);
+                if(done[t])  checkpoint::take(fs, current, tiles[t]);
+                for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                    if(aovs.enabled(ch) && (pass > 0 || done[t])) {
+                        checkpoint::take(fs, aovs.channels[ch], tiles[t]);
+                    }
+                }
+            }
+            if(!fs) {
+                fail(path + " is truncated.");
+            }
+            return true;
+        }
+
+        /* Bit mask of the saved AOV channels. */
+        auto channels() const -> u32 {
+            u32 mask = 0;
+            for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                if(aovs.enabled(ch)) {
+                    mask |= 1 << ch;
+                }
+            }
+            return mask;
+        }
+
+        auto finished() const -> bool {
+            return pass >= passes;
+        }
+
+        auto stopped() const -> bool {
+            return stop && *stop;
+        }
+
+        /* Remove the checkpoint once its render has been written out. */
+        auto clear() -> void {
+            if(enabled()) {
+                remove(path.c_str());
+                remove((path + ".tmp").c_str());
+            }
+        }
+};
+
+namespace checkpoint {
+
+    /* The key of a partial render without its region and shard, which every part of a render shares. */
+    auto render(const string & key) -> string {
+        const usize shard  = key.find_last_of(' ');
+        const usize region = shard == string::npos || shard == 0 ? string::npos : key.find_last_of(' ', shard - 1);
+        return region == string::npos ? key : key.substr(0, region);
+    }
+
+    /*
+     * Assemble the finished partial renders at paths, as written with
+     * --region or --shard, into one image and its AOVs. Every part has to
+     * come from the same render: scene, shader, camera, seed, passes and
+     * AOVs, only the region or shard can differ.
+     */
+    auto merge(const vector<string> & paths, FloatBuffer & image, AOVs & aovs) -> void {
+
+        vector<u8> covered;
+        string first;
+        u32 passes = 0;
+        u32 mask   = 0;
+
+        for(const string & path : paths) {
+
+            Checkpoint part(path);
+            if(!part.load()) {
+                fail(path + " does not exist.");
+            }
+            if(!part.finished()) {
+                fail(path + " is not a finished render.");
+            }
+            if(covered.empty()) {
+                first = part.key;
+                passes = part.passes;
+                mask  = part.channels();
+                image = FloatBuffer(part.sum.width, part.sum.height);
+                covered.assign(image.data.size(), 0);
+                for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                    if(part.aovs.enabled(ch)) {
+                        aovs.channels[ch] = FloatBuffer(image.width, image.height);
+                    }
+                }
+            } else if(part.sum.width != image.width || part.sum.height != image.height
+                || !equal(render(part.key), render(first)) || part.passes != passes || part.channels() != mask) {
+                fail(path + " is not part of the same render.");
+            }
+
+            const FloatBuffer partial = part.image();
+            for(const Tile & tile : part.tiles) {
+                copy(image, partial, tile);
+                for(u32 ch = 0; ch < aov::COUNT; ch++) {
+                    if(part.aovs.enabled(ch) && aovs.enabled(ch)) {
+                        copy(aovs.channels[ch], part.aovs.get(ch), tile);
+                    }
+                }
+                for(u32 y = tile.y0; y < tile.y1; y++) {
+                    fill(&covered[y * image.width + tile.x0], &covered[y * image.width + tile.x1], 1);
+                }
+            }
+        }
+        if(covered.empty() || find(covered.begin(), covered.end(), 0) != covered.end()) {
+            fail("The partial renders do not cover the whole image.");
+        }
+    }
+}
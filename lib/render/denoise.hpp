@@ -0,0 +1,131 @@
+#pragma once
+
+#include "lib/data/floatbuffer.hpp"
+#include "lib/data/aov.hpp"
+#include "lib/util/parallel.hpp"
+
+using namespace std;
+
+/*
+ * Edge-avoiding a-trous wavelet denoiser, after "Edge-Avoiding A-Trous
+ * Wavelet Transform for fast Global Illumination Filtering" by Dammertz et al.
+ *
+ * The noisy image is repeatedly blurred with a 5x5 B3-spline kernel whose taps
+ * are spread further apart on every iteration. Each tap is weighted by how
+ * similar its color, albedo, normal and depth are to the center pixel so that
+ * geometric and texture edges survive while sampling noise is smoothed out.
+ */
+namespace denoise {
+
+    const u32 ITERATIONS   = 5;
+    const f32 MIN_ALBEDO   = 0.01;
+    const f32 SIGMA_COLOR  = 4.0;
+    const f32 SIGMA_NORMAL = 0.3;
+    const f32 SIGMA_ALBEDO = 0.1;
+    const f32 SIGMA_DEPTH  = 0.05;
+
+    const f32 KERNEL[5] = { 1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0 };
+
+    /* The AOV channels the filter is guided by. */
+    const vector<string> GUIDES = { "albedo", "normal", "depth" };
+
+    /*
+     * Filter color using the GUIDES channels of g, which must be enabled.
+     * Channels are split into planes so the inner loops run over contiguous
+     * floats and vectorize well.
+     */
+    auto filter(const FloatBuffer & color, const AOVs & g) -> FloatBuffer {
+
+        const u32 w = color.width;
+        const u32 h = color.height;
+        const usize n = color.data.size();
+
+        Plane c[3], a[3], nrm[3], z(n), tmp[3];
+
+        for(u32 k = 0; k < 3; k++) {
+            c[k].resize(n);
+            a[k].resize(n);
+            nrm[k].resize(n);
+            tmp[k].resize(n);
+        }
+
+        // Demodulate albedo so texture detail is not blurred away
+        for(usize p = 0; p < n; p++) {
+            for(u32 k = 0; k < 3; k++) {
+                a[k][p]   = g.get(aov::ALBEDO).data[p][k];
+                nrm[k][p] = g.get(aov::NORMAL).data[p][k];
+                c[k][p]   = color.data[p][k] / max(a[k][p], MIN_ALBEDO);
+            }
+            z[p] = g.get(aov::DEPTH).data[p].x;
+        }
+
+        for(u32 it = 0; it < ITERATIONS; it++) {
+
+            const i32 step     = 1 << it;
+            const f32 sigmaC   = SIGMA_COLOR / f32(1 << it);
+            const f32 invColor = 1.0 / (sigmaC * sigmaC);
+            const f32 invNorm  = 1.0 / (SIGMA_NORMAL * SIGMA_NORMAL);
+            const f32 invAlb   = 1.0 / (SIGMA_ALBEDO * SIGMA_ALBEDO);
+            const f32 invDepth = 1.0 / SIGMA_DEPTH;
+
+            parallel::each(h, [&](u32 y) {
+                for(u32 x = 0; x < w; x++) {
+
+                    const usize p = y * w + x;
+                    f32 sum[3] = { 0, 0, 0 };
+                    f32 total  = 0;
+
+                    for(i32 j = 0; j < 5; j++) {
+
+                        const i32 qy  = min(max(i32(y) + (j - 2) * step, 0), i32(h) - 1);
+                        const usize row = usize(qy) * w;
+
+                        for(i32 i = 0; i < 5; i++) {
+
+                            const i32 qx  = min(max(i32(x) + (i - 2) * step, 0), i32(w) - 1);
+                            const usize q = row + qx;
+
+                            f32 dc = 0, dn = 0, da = 0;
+                            for(u32 k = 0; k < 3; k++) {
+                                dc += (c[k][p] - c[k][q]) * (c[k][p] - c[k][q]);
+                                dn += (nrm[k][p] - nrm[k][q]) * (nrm[k][p] - nrm[k][q]);
+                                da += (a[k][p] - a[k][q]) * (a[k][p] - a[k][q]);
+                            }
+                            const f32 dz = fabs(z[p] - z[q]) / (max(z[p], z[q]) + body::EPSILON);
+
+                            const f32 weight = KERNEL[i] * KERNEL[j] * exp(-(
+                                dc * invColor +
+                                dn * invNorm  +
+                                da * invAlb   +
+                                dz * invDepth
+                            ));
+
+                            for(u32 k = 0; k < 3; k++) {
+                                sum[k] += weight * c[k][q];
+                            }
+                            total += weight;
+                        }
+                    }
+                    for(u32 k = 0; k < 3; k++) {
+                        tmp[k][p] = sum[k] / total;
+                    }
+                }
+            });
+
+            for(u32 k = 0; k < 3; k++) {
+                c[k].swap(tmp[k]);
+            }
+        }
+
+        // Remodulate albedo
+        FloatBuffer out(w, h);
+        for(usize p = 0; p < n; p++) {
+            out.data[p] = Vec(
+                c[0][p] * max(a[0][p], MIN_ALBEDO),
+                c[1][p] * max(a[1][p], MIN_ALBEDO),
+                c[2][p] * max(a[2][p], MIN_ALBEDO)
+            );
+        }
+        return out;
+    }
+}
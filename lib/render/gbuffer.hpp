@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include "lib/core.hpp"
+#include "lib/data/tile.hpp"
+#include "lib/util/memory.hpp"
+
+using namespace std;
+
+namespace gbuffer {
+
+    const string MAGIC = "RAYNGBF1";
+
+    /// Body ids of samples not traced yet and of samples that hit nothing
+    const u32 UNSET = 0xFFFFFFFF;
+    const u32 MISS  = 0xFFFFFFFE;
+
+    /* FNV-1a, to name cache files after their key. */
+    auto hash(const string & s) -> u64 {
+        u64 h = 14695981039346656037ull;
+        for(const char c : s) {
+            h ^= u8(c);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+}
+
+/*
+ * Primary visibility cache. Stores which body every primary sample hit
+ * first and at what distance, for every sample of every pass of a view.
+ * Samples found in the cache skip traversal and only intersect the body
+ * they hit, which yields the exact same intersection with the scene's
+ * current materials, so a render can be reshaded with another shader or
+ * edited materials without tracing primary rays again. With --raster,
+ * the samples of each tile are rasterized into it before the tile renders.
+ */
+class GBuffer {
+
+    public:
+        class Hit {
+            public:
+                u32 id;
+                f32 t;
+        };
+
+        string key;
+        u32 width;
+        u32 height;
+        u32 samples;
+        u32 passes;
+        vector<Hit, memory::Tracked<Hit, memory::FRAMEBUFFERS>> hits;
+        usize known;
+
+        GBuffer(const string & k, const u32 w, const u32 h, const u32 s, const u32 p) :
+            key(k),
+            width(w),
+            height(h),
+            samples(s),
+            passes(p),
+            hits(usize(w) * h * s * p, Hit { gbuffer::UNSET, 0 }),
+            known(0)
+        {}
+
+        auto index(const u32 pass, const u32 x, const u32 y, const u32 k) const -> usize {
+            return ((usize(pass) * height + y) * width + x) * samples + k;
+        }
+
+        /*
+         * Find the closest hit of ray, the primary ray of sample slot, from
+         * the cache if it has been traced before. Slots are only ever written
+         * by the thread rendering their pixel.
+         */
+        auto intersects(const Scene & scene, const Ray & ray, const usize slot, Intersection & i) -> bool {
+            return lookup(scene, ray, hits[slot], i);
+        }
+
+        /* Find the closest hit of ray from hit, tracing it and filling hit in when it is unset. */
+        static auto lookup(const Scene & scene, const Ray & ray, Hit & hit, Intersection & i) -> bool {
+            if(hit.id == gbuffer::UNSET) {
+                const bool found = scene.intersects(ray, body::EPSILON, FLT_MAX, i);
+                hit = found ? Hit { i.id, i.t } : Hit { gbuffer::MISS, 0 };
+                return found;
+            }
+            if(hit.id == gbuffer::MISS) {
+                return false;
+            }
+            // Intersecting the same body with the same ray gives the same t
+            const f32 tolerance = max(hit.t * f32(1e-5), f32(1e-6));
+            if(hit.id < scene.bodies.size() && scene.bodies[hit.id].intersects(ray, hit.t - tolerance, hit.t + tolerance, i)) {
+                i.id = hit.id;
+                return true;
+            }
+            return scene.intersects(ray, body::EPSILON, FLT_MAX, i);
+        }
+
+        /* Whether every sample of tile in pass is known. */
+        auto holds(const u32 pass, const Tile & tile) const -> bool {
+            for(u32 y = tile.y0; y < tile.y1; y++) {
+                const usize first = index(pass, tile.x0, y, 0);
+                const usize last  = index(pass, tile.x1, y, 0);
+                for(usize s = first; s < last; s++) {
+                    if(hits[s].id == gbuffer::UNSET) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        auto traced() const -> usize {
+            return count_if(hits.begin(), hits.end(), [](const Hit & h) { return h.id != gbuffer::UNSET; });
+        }
+
+        /* Cache file for this key in dir. */
+        auto path(const string & dir) const -> string {
+            stringstream stream;
+            stream << dir << "/" << hex << setw(16) << setfill('0') << gbuffer::hash(key) << ".gbuf";
+            return stream.str();
+        }
+
+        /* Read the cache for this key from dir. Returns false when there is none. */
+        auto load(const string & dir) -> bool {
+
+            ifstream fs(path(dir), ios::binary);
+            if(!fs) {
+                return false;
+            }
+            string magic(gbuffer::MAGIC.size(), ' ');
+            fs.read(&magic[0], magic.size());
+            u32 size = 0;
+            fs.read((char *) &size, sizeof(size));
+            string k(size, ' ');
+            fs.read(&k[0], k.size());
+
+            if(!equal(magic, gbuffer::MAGIC) || !equal(k, key)) {
+                return false;
+            }
+            fs.read((char *) hits.data(), hits.size() * sizeof(Hit));
+            if(!fs) {
+                fill(hits.begin(), hits.end(), Hit { gbuffer::UNSET, 0 });
+                return false;
+            }
+            known = traced();
+            return true;
+        }
+
+        /* Write the cache to dir if the render traced anything new. */
+        auto save(const string & dir) const -> void {
+
+            if(traced() == known) {
+                return;
+            }
+            const string to  = path(dir);
+            const string tmp = to + ".tmp";
+            {
+                ofstream fs(tmp, ios::binary);
+                const u32 size = key.size();
+                fs.write(gbuffer::MAGIC.data(), gbuffer::MAGIC.size());
+                fs.write((const char *) &size, sizeof(size));
+                fs.write(key.data(), key.size());
+                fs.write((const char *) hits.data(), hits.size() * sizeof(Hit));
+                if(!fs) {
+                    fail("Could not write " + tmp + ".");
+                }
+            }
+            remove(to.c_str());
+            rename(tmp.c_str(), to.c_str());
+        }
+};
+
+/*
+ * Primary hits of the samples of one tile, row by row with the samples of
+ * each pixel together, carved from the scratch arena of the thread
+ * rendering the tile. Rasterizing fills these in, and only a G-buffer
+ * kept for --gbuffer holds the hits of the whole image.
+ */
+class TileHits {
+
+    public:
+        Tile tile;
+        u32 samples;
+        GBuffer::Hit * hits;
+
+        TileHits() : samples(0), hits(nullptr) {}
+
+        TileHits(const Tile & t, const u32 s, GBuffer::Hit * h) : tile(t), samples(s), hits(h) {}
+
+        auto index(const u32 x, const u32 y, const u32 k) const -> usize {
+            return (usize(y - tile.y0) * (tile.x1 - tile.x0) + (x - tile.x0)) * samples + k;
+        }
+
+        /* Copy the hits into g for pass. */
+        auto store(GBuffer & g, const u32 pass) const -> void {
+            for(u32 y = tile.y0; y < tile.y1; y++) {
+                copy(hits + index(tile.x0, y, 0), hits + index(tile.x1, y, 0), g.hits.begin() + g.index(pass, tile.x0, y, 0));
+            }
+        }
+};
@@ -0,0 +1,465 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "lib/render/shader.hpp"
+#include "lib/util/trace.hpp"
+
+using namespace std;
+
+namespace guide {
+
+    /// Fractions of diffuse bounces sampled from the guide rather than the cosine lobe regions choose from
+    const u32 CHOICES = 4;
+    const f32 FRACTIONS[CHOICES] = { 0, 0.25, 0.5, 0.75 };
+
+    /// Directional cells holding more than this fraction of their region's energy are split
+    const f32 RHO = 0.01;
+
+    /// Deepest directional subdivision
+    const u32 DEPTH = 16;
+
+    /// Bounces a region may record in a one pass iteration before it is split
+    const u32 SPLIT = 4000;
+
+    /// Points kept per region to decide where to split it
+    const u32 POINTS = 64;
+
+    /// Training iterations, each twice as many passes as the one before
+    const u32 ITERATIONS = 4;
+
+    const f32 PI = 3.14159265358979;
+
+    /*
+     * Relaxed atomic add. Only the total matters and it is only read once
+     * the pass recording it is over.
+     */
+    auto add(atomic<f32> & a, const f32 x) -> void {
+        f32 old = a.load(memory_order_relaxed);
+        while(!a.compare_exchange_weak(old, old + x, memory_order_relaxed)) {}
+    }
+}
+
+/*
+ * Distribution of incoming light over the sphere of directions, as a
+ * quadtree over the unit square mapped onto the sphere with equal areas.
+ * Every node holds the energy of its four quadrants as learned in the last
+ * training iteration, which sampling follows, and records what arrives
+ * in the current one for the next, along with how many bounces recorded
+ * it and a uniform sample of where they were. It also estimates how much
+ * variance each fraction of guided bounces would have, to choose the
+ * fraction with the least for the next iteration.
+ */
+class Directions {
+
+    public:
+        class Node {
+            public:
+                u32 children[4];
+                f32 energy[4];
+        };
+
+        vector<Node> nodes;
+        unique_ptr<atomic<f32>[]> recorded;
+        atomic<u32> samples;
+        atomic<f32> points[guide::POINTS][3];
+        atomic<f32> moments[guide::CHOICES];
+        f32 fraction;
+
+        /* Regions only sample the cosine lobe until they have seen how well their guide does. */
+        Directions() : nodes(1, Node { { 0, 0, 0, 0 }, { 0, 0, 0, 0 } }), fraction(0) {
+            reset();
+        }
+
+        Directions(const Directions & d) : nodes(d.nodes), fraction(d.fraction) {
+            reset();
+        }
+
+        auto reset() -> void {
+            recorded.reset(new atomic<f32>[nodes.size() * 4]);
+            for(usize k = 0; k < nodes.size() * 4; k++) {
+                recorded[k] = 0;
+            }
+            samples = 0;
+            for(atomic<f32> & m : moments) {
+                m = 0;
+            }
+        }
+
+        auto total() const -> f32 {
+            return nodes[0].energy[0] + nodes[0].energy[1] + nodes[0].energy[2] + nodes[0].energy[3];
+        }
+
+        /*
+         * Square coordinates of direction d, height and angle around the z
+         * axis. The poles, where cells get thin, face the camera rather than
+         * the sky.
+         */
+        static auto square(const Vec & d, f32 & u, f32 & v) -> void {
+            u = min(max((d.z + 1) / 2, 0.f), 1 - FLT_EPSILON);
+            v = atan2(d.y, d.x) / (2 * guide::PI) + 0.5f;
+            v = v >= 1 ? 0 : v;
+        }
+
+        static auto direction(const f32 u, const f32 v) -> Vec {
+            const f32 z   = 2 * u - 1;
+            const f32 r   = sqrt(max(0.f, 1 - z * z));
+            const f32 phi = 2 * guide::PI * (v - 0.5f);
+            return Vec(r * cos(phi), r * sin(phi), z);
+        }
+
+        /* Descend to the leaf quadrant containing u, v, which are made relative to it. */
+        auto leaf(f32 & u, f32 & v, u32 & node, f32 & density) const -> u32 {
+            node = 0;
+            density = 1;
+            for(;;) {
+                const f32 * e = nodes[node].energy;
+                const f32 sum = e[0] + e[1] + e[2] + e[3];
+                const u32 q = (u >= 0.5f) | (v >= 0.5f) << 1;
+                density *= sum > 0 ? 4 * e[q] / sum : 1;
+                u = 2 * u - (q & 1);
+                v = 2 * v - (q >> 1);
+                if(!nodes[node].children[q]) {
+                    return q;
+                }
+                node = nodes[node].children[q];
+            }
+        }
+
+        /* Density of sampling direction d, per unit solid angle, and the cell it falls in. */
+        auto pdf(const Vec & d, u32 & cell) const -> f32 {
+            f32 u, v, density;
+            u32 node;
+            square(d, u, v);
+            const u32 q = leaf(u, v, node, density);
+            cell = node * 4 + q;
+            return density / (4 * guide::PI);
+        }
+
+        /* A direction drawn in proportion to the learned energy. */
+        auto sample() const -> Vec {
+            f32 u0 = 0;
+            f32 v0 = 0;
+            f32 size = 1;
+            u32 node = 0;
+            for(;;) {
+                const f32 * e = nodes[node].energy;
+                f32 r = frand() * (e[0] + e[1] + e[2] + e[3]);
+                u32 q = 0;
+                for(u32 k = 0; k < 4; k++) {
+                    if(e[k] > 0) {
+                        q = k;
+                        if(r < e[k]) {
+                            break;
+                        }
+                        r -= e[k];
+                    }
+                }
+                size /= 2;
+                u0 += (q & 1) * size;
+                v0 += (q >> 1) * size;
+                if(!nodes[node].children[q]) {
+                    break;
+                }
+                node = nodes[node].children[q];
+            }
+            return direction(u0 + frand() * size, v0 + frand() * size);
+        }
+
+        /*
+         * Record radiance arriving at p from a direction in cell, at an
+         * angle with the normal of the given cosine. It was sampled with
+         * density pdf, of which guided is the guide's.
+         */
+        auto record(const Vec & p, const u32 cell, const f32 radiance, const f32 cosine, const f32 guided, const f32 pdf) -> void {
+            const u32 n = samples.fetch_add(1, memory_order_relaxed);
+
+            // Reservoir sampling, points written at once may mix but stay within the region
+            const u32 slot = n < guide::POINTS ? n : rng::hash(n, cell) % (n + 1);
+            if(slot < guide::POINTS) {
+                for(u32 k = 0; k < 3; k++) {
+                    points[slot][k].store(p[k], memory_order_relaxed);
+                }
+            }
+
+            if(radiance <= 0) {
+                return;
+            }
+            guide::add(recorded[cell], radiance * cosine / pdf);
+
+            // Second moment of the estimate had the bounce been sampled with each fraction, from every fourth bounce
+            if(total() > 0 && n % 4 == 0) {
+                const f32 lambert = radiance * cosine / guide::PI;
+                for(u32 k = 0; k < guide::CHOICES; k++) {
+                    const f32 f = guide::FRACTIONS[k];
+                    guide::add(moments[k], lambert * lambert / (f * guided + (1 - f) * cosine / guide::PI) / pdf);
+                }
+            }
+        }
+
+        /* The sampled points of where bounces were recorded. */
+        auto sampled() const -> vector<Vec> {
+            vector<Vec> out(min(samples.load(), guide::POINTS));
+            for(u32 s = 0; s < out.size(); s++) {
+                out[s] = Vec(points[s][0].load(), points[s][1].load(), points[s][2].load());
+            }
+            return out;
+        }
+
+        /*
+         * The distribution learned from what was recorded. Quadrants with
+         * more than RHO of the energy are split, others collapse, so cells
+         * are small only where a lot of light comes from. Without any light
+         * recorded the distribution stays the same.
+         */
+        auto refined() const -> Directions {
+
+            vector<f32> sums(nodes.size() * 4);
+            for(usize n = nodes.size(); n-- > 0;) {
+                for(u32 q = 0; q < 4; q++) {
+                    const u32 c = nodes[n].children[q];
+                    sums[n * 4 + q] = c
+                        ? sums[c * 4] + sums[c * 4 + 1] + sums[c * 4 + 2] + sums[c * 4 + 3]
+                        : recorded[n * 4 + q].load();
+                }
+            }
+            const f32 all = sums[0] + sums[1] + sums[2] + sums[3];
+            if(all <= 0) {
+                return *this;
+            }
+
+            Directions out;
+            out.nodes.clear();
+            grow(out, sums, &sums[0], 0, all, 0);
+            out.reset();
+            out.fraction = fraction;
+            if(moments[0] > 0) {
+                u32 best = 0;
+                for(u32 k = 1; k < guide::CHOICES; k++) {
+                    best = moments[k] < moments[best] ? k : best;
+                }
+                out.fraction = guide::FRACTIONS[best];
+            }
+            return out;
+        }
+
+    private:
+        static const u32 NONE = 0xFFFFFFFF;
+
+        /*
+         * Add a node to out with quadrant energies e, splitting quadrants
+         * the way node from of this tree is split, if there is one, and
+         * further while they hold enough energy. Returns its index.
+         */
+        auto grow(Directions & out, const vector<f32> & sums, const f32 * e, const u32 from, const f32 all, const u32 depth) const -> u32 {
+
+            const u32 at = out.nodes.size();
+            out.nodes.push_back(Node { { 0, 0, 0, 0 }, { e[0], e[1], e[2], e[3] } });
+            if(depth + 1 >= guide::DEPTH) {
+                return at;
+            }
+            for(u32 q = 0; q < 4; q++) {
+                if(e[q] <= guide::RHO * all) {
+                    continue;
+                }
+                const u32 c = from == NONE ? 0 : nodes[from].children[q];
+                // Quadrants not split before share their energy evenly
+                const f32 even[4] = { e[q] / 4, e[q] / 4, e[q] / 4, e[q] / 4 };
+                const u32 made = grow(out, sums, c ? &sums[c * 4] : even, c ? c : NONE, all, depth + 1);
+                out.nodes[at].children[q] = made;
+            }
+            return at;
+        }
+};
+
+/*
+ * Path guiding after Müller et al.'s practical path guiding. Space is split
+ * into a binary tree of regions, each with a directional distribution of
+ * the light arriving there. Bounces sample a mix of that distribution and
+ * the cosine lobe and record the light they find, so the guide learns
+ * where light comes from while the first passes render.
+ *
+ * Training runs in iterations of 1, 2, 4, ... passes. Between them, regions
+ * that recorded many bounces are split at the median of where they were,
+ * across the longest side, and every distribution is refined from what
+ * its region recorded. Both only happen between passes, while bounces
+ * only add to their leaf's counters atomically, so threads rarely contend
+ * and never lock.
+ */
+class Guide {
+
+    public:
+        class Region {
+            public:
+                u32 axis;
+                f32 plane;
+                u32 children[2];
+                unique_ptr<Directions> directions;
+        };
+
+        vector<Region> regions;
+        u32 iterations;
+        u32 length;
+        u32 done;
+
+        Guide() : iterations(0), length(1), done(0) {
+            regions.push_back(Region { 0, 0, { 0, 0 }, unique_ptr<Directions>(new Directions()) });
+        }
+
+        auto training() const -> bool {
+            return iterations < guide::ITERATIONS;
+        }
+
+        /* Directions of the region containing p. */
+        auto at(const Vec & p) const -> Directions & {
+            u32 r = 0;
+            while(regions[r].children[0]) {
+                r = regions[r].children[p[regions[r].axis] >= regions[r].plane];
+            }
+            return *regions[r].directions;
+        }
+
+        /* Called once before every pass, ends the training iteration once it has all its passes. */
+        auto begin() -> void {
+            if(training() && done == length) {
+                refine(guide::SPLIT * sqrt(f32(length)));
+                iterations++;
+                length *= 2;
+                done = 0;
+            }
+            done++;
+        }
+
+        auto refine(const f32 threshold) -> void {
+            trace::Span span("guide");
+            const usize count = regions.size();
+            for(usize r = 0; r < count; r++) {
+                if(!regions[r].children[0]) {
+                    const Directions & d = *regions[r].directions;
+                    vector<Vec> points = d.sampled();
+                    const f32 weight = points.empty() ? 0 : f32(d.samples) / points.size();
+                    split(r, d.refined(), points.begin(), points.end(), weight, threshold);
+                }
+            }
+            debug << "Guide iteration " << iterations + 1 << " with " << regions.size() << " regions" << endl;
+        }
+
+        /*
+         * Give region r directions d, splitting it while the points in it,
+         * each standing for weight samples, are more than threshold.
+         */
+        auto split(
+            const u32 r,
+            const Directions & d,
+            const vector<Vec>::iterator first,
+            const vector<Vec>::iterator last,
+            const f32 weight,
+            const f32 threshold
+        ) -> void {
+
+            Vec low(FLT_MAX, FLT_MAX, FLT_MAX);
+            Vec high(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            for(auto p = first; p != last; p++) {
+                low  = glm::min(low, *p);
+                high = glm::max(high, *p);
+            }
+            const Vec size = high - low;
+            const u32 axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+
+            if((last - first) * weight <= threshold || last - first < 2 || !(size[axis] > body::EPSILON)) {
+                regions[r].directions.reset(new Directions(d));
+                return;
+            }
+            const auto middle = first + (last - first) / 2;
+            nth_element(first, middle, last, [&](const Vec & a, const Vec & b) { return a[axis] < b[axis]; });
+
+            regions[r].axis  = axis;
+            regions[r].plane = (*middle)[axis];
+            regions[r].directions.reset();
+            for(u32 k = 0; k < 2; k++) {
+                regions[r].children[k] = regions.size();
+                regions.push_back(Region { 0, 0, { 0, 0 }, nullptr });
+            }
+            split(regions[r].children[0], d, first, middle, weight, threshold);
+            split(regions[r].children[1], d, middle, last, weight, threshold);
+        }
+};
+
+namespace guide {
+
+    mutex lock;
+    map<string, unique_ptr<Guide>> guides;
+
+    /* The guide of a scene, kept for as long as the program runs. */
+    auto get(const Scene & scene) -> Guide & {
+        thread_local const Scene * last = nullptr;
+        thread_local Guide * found = nullptr;
+        if(&scene != last) {
+            lock_guard<mutex> guard(lock);
+            unique_ptr<Guide> & g = guides[scene.name];
+            if(!g) {
+                g.reset(new Guide());
+            }
+            last  = &scene;
+            found = g.get();
+        }
+        return *found;
+    }
+}
+
+namespace shader {
+
+    /*
+     * Scatter with diffuse bounces importance sampled from the scene's
+     * guide, mixed with the cosine lobe and weighted by the density of the
+     * mix, so the estimate stays unbiased however poor the guide is.
+     */
+    struct Guided {
+        static auto surface(const Ray & ray, const Intersection & i, const Scene & scene, const u32 depth) -> const Vec {
+            if(depth > MAX_DEPTH) {
+                return vec::zero;
+            }
+
+            Vec color = vec::zero;
+
+            // Diffuse color
+            if(glm::length(i.material->diff) > body::EPSILON) {
+                Vec n = glm::normalize(i.normal);
+                if(glm::dot(n, ray.direction) > 0) {
+                    n = -n;
+                }
+                Guide & guide = ::guide::get(scene);
+                Directions & directions = guide.at(i.point);
+                const bool learned = directions.total() > 0;
+                const f32 fraction = learned ? directions.fraction : 0;
+
+                Vec d = frand() < fraction ? directions.sample() : n + glm::normalize(vec::rand());
+                d = glm::length(d) > body::EPSILON ? glm::normalize(d) : n;
+
+                const f32 cosine = glm::dot(d, n);
+                if(cosine > 0) {
+                    u32 cell = 0;
+                    const f32 guided = fraction > 0 || guide.training() ? directions.pdf(d, cell) : 0;
+                    const f32 pdf = fraction * guided + (1 - fraction) * cosine / ::guide::PI;
+                    const Vec incoming = trace<Guided>(bounce(ray, i, d, SPREAD), scene, depth + 1);
+                    color = color + i.material->diff * texture::lookup(ray, i) * incoming * (cosine / ::guide::PI / pdf);
+                    if(guide.training()) {
+                        directions.record(i.point, cell, (incoming.x + incoming.y + incoming.z) / 3, cosine, guided, pdf);
+                    }
+                }
+            }
+            // Reflection
+            if(glm::length(i.material->refl) > body::EPSILON) {
+                const Vec reflect = vec::reflect(ray.direction, i.normal);
+                color = color + i.material->refl * trace<Guided>(bounce(ray, i, reflect + i.material->fuzz * vec::rand()), scene, depth + 1);
+            }
+            return color;
+        }
+    };
+    const Shader guided("guided", Guided::surface, [](const Scene & scene) {
+        ::guide::get(scene).begin();
+    });
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "lib/render/render.hpp"
+#include "lib/util/mapped.hpp"
+
+using namespace std;
+
+namespace interactive {
+
+    const string MAGIC = "RAYNFB01";
+
+    /// Bytes before the pixels of the framebuffer file
+    const usize HEADER = 64;
+
+    /// Smallest fraction of the resolution frames drop to while the camera moves
+    const f32 MIN_SCALE = 1.0 / 16;
+}
+
+/*
+ * Framebuffer file shared with a viewer. After a 64 byte header, the
+ * pixels are 8-bit RGB rows from top to bottom at the full resolution.
+ * The sequence number is odd while a frame is being written and even once
+ * it is complete, so a viewer polls it and copies the pixels whenever it
+ * changed and is even, and again if it changed meanwhile.
+ */
+class Framebuffer {
+
+    public:
+        class Header {
+            public:
+                char magic[8];
+                u32 width;
+                u32 height;
+                atomic<u32> sequence;
+                u32 frame;
+                u32 detail;
+                u32 passes;
+                f32 milliseconds;
+        };
+
+        MappedFile file;
+        Header * header;
+        u8 * pixels;
+
+        Framebuffer(const string & path, const u32 w, const u32 h) :
+            file(path, interactive::HEADER + usize(w) * h * 3),
+            header(new (file.data) Header()),
+            pixels(file.data + interactive::HEADER)
+        {
+            copy(interactive::MAGIC.begin(), interactive::MAGIC.end(), header->magic);
+            header->width  = w;
+            header->height = h;
+        }
+
+        /*
+         * Scale image up to the full resolution and publish it. Detail is the
+         * width it was rendered at, passes how many passes it averages and
+         * milliseconds how long it took.
+         */
+        auto publish(const FloatBuffer & image, const u32 passes, const f32 milliseconds) -> void {
+
+            const Buffer colors = image.buffer();
+            const u32 w = header->width;
+            const u32 h = header->height;
+
+            header->sequence++;
+            for(u32 y = 0; y < h; y++) {
+                const u32 sy = (h - 1 - y) * colors.height / h;
+                u8 * row = pixels + usize(y) * w * 3;
+                for(u32 x = 0; x < w; x++) {
+                    const Color & c = colors.get(x * colors.width / w, sy);
+                    row[x * 3 + 0] = c.r;
+                    row[x * 3 + 1] = c.g;
+                    row[x * 3 + 2] = c.b;
+                }
+            }
+            header->frame++;
+            header->detail       = image.width;
+            header->passes       = passes;
+            header->milliseconds = milliseconds;
+            header->sequence++;
+        }
+};
+
+/*
+ * Camera updates read from a stream on a thread of their own, one command
+ * per line:
+ *
+ *   camera x,y,z x,y,z x,y,z    move the camera, as --camera
+ *   fov degrees                 set the vertical FOV, as --fov
+ *   quit                        stop, as does the end of the stream
+ *
+ * Only the latest state matters, updates arriving while a frame renders
+ * are merged. Changed is set as soon as one arrives, to cut short frames
+ * refining the previous state.
+ */
+class Input {
+
+    public:
+        mutex lock;
+        condition_variable signal;
+        CameraView view;
+        f32 fov;
+        atomic<bool> changed;
+        bool quit;
+        thread reader;
+
+        Input(istream & in, const CameraView & v, const f32 f) : view(v), fov(f), changed(false), quit(false) {
+            reader = thread([&]() {
+                string line;
+                while(getline(in, line)) {
+                    stringstream stream(line);
+                    string command;
+                    stream >> command;
+                    lock_guard<mutex> guard(lock);
+                    if(equal(command, "camera")) {
+                        string from, to, vup;
+                        stream >> from >> to >> vup;
+                        view = CameraView(stov(from), stov(to), stov(vup));
+                    } else if(equal(command, "fov")) {
+                        stream >> fov;
+                    } else if(equal(command, "quit")) {
+                        break;
+                    } else {
+                        debug << "Unknown command " << command << endl;
+                        continue;
+                    }
+                    changed = true;
+                    signal.notify_one();
+                }
+                lock_guard<mutex> guard(lock);
+                quit    = true;
+                changed = true;
+                signal.notify_one();
+            });
+        }
+
+        /* Only ever destroyed once the reader has seen the input end. */
+        ~Input() {
+            reader.join();
+        }
+
+        /*
+         * Take the latest camera state. When idle, wait for it to change
+         * first. Returns false once input has ended.
+         */
+        auto next(CameraView & v, f32 & f, bool & moved, const bool idle) -> bool {
+            unique_lock<mutex> guard(lock);
+            if(idle) {
+                signal.wait(guard, [&]() { return changed || quit; });
+            }
+            v     = view;
+            f     = fov;
+            moved = changed;
+            changed = false;
+            return !quit;
+        }
+};
+
+namespace interactive {
+
+    /*
+     * Render scene as the camera is moved, publishing every frame to the
+     * framebuffer at path. While the camera moves, frames take one sample
+     * per pixel at a resolution adapted to render in target seconds. Once
+     * it stops, the resolution doubles frame by frame up to the full one,
+     * then passes with aa are averaged in until there are passes of them.
+     */
+    auto run(
+        const string & path,
+        const Resolution & res,
+        const CameraView & start,
+        const f32 startFov,
+        const Scene & scene,
+        const Shader & shader,
+        const AA & aa,
+        const u32 passes,
+        const f64 target,
+        const bool rasterize
+    ) -> void {
+
+        Framebuffer framebuffer(path, res.width, res.height);
+        Input input(cin, start, startFov);
+
+        CameraView view = start;
+        f32 fov   = startFov;
+        f32 scale  = 1;
+        f32 motion = 0.25;
+        bool moving = true;
+        bool idle   = false;
+        unique_ptr<Checkpoint> progress;
+        unique_ptr<Raster> raster;
+        AOVs none;
+
+        for(u32 frame = 0;; frame++) {
+
+            bool moved = false;
+            if(!input.next(view, fov, moved, idle)) {
+                break;
+            }
+            moving = moving || moved;
+            idle   = false;
+
+            trace::Span span("frame", TRACING ? "\"frame\": " + to_string(frame) : "");
+            const auto begin = chrono::steady_clock::now();
+            const Camera camera = view.camera(fov, res.aspect);
+            if(moving && rasterize) {
+                raster.reset(new Raster(camera, scene));
+            }
+
+            FloatBuffer image;
+            u32 done = 1;
+
+            if(moving || scale * 2 < 1) {
+                scale = moving ? motion : scale * 2;
+                const Resolution detail(max(u32(res.width * scale), u32(1)), max(u32(res.height * scale), u32(1)));
+                image = render(detail, camera, scene, shader, aa::none, none,
+                    tile::split(detail.width, detail.height), nullptr, nullptr, raster.get());
+                progress.reset();
+            } else {
+                if(!progress) {
+                    progress.reset(new Checkpoint("", "", res.width, res.height, 0, tile::split(res.width, res.height), none));
+                }
+                progress->passes++;
+                progress->stop = &input.changed;
+                image = render(camera, scene, shader, aa, none, *progress);
+                if(progress->stopped()) {
+                    continue;
+                }
+                done  = progress->pass;
+                idle  = progress->finished() && progress->passes >= passes;
+            }
+
+            const f64 seconds = chrono::duration<f64>(chrono::steady_clock::now() - begin).count();
+            framebuffer.publish(image, done, seconds * 1000);
+
+            // Pixels scale with the square of the resolution, damped to settle quickly
+            if(moving) {
+                const f32 factor = min(max(sqrt(target / max(seconds, 1e-6)), 0.5), 2.0);
+                motion = min(max(motion * factor, MIN_SCALE), f32(1));
+                moving = false;
+            }
+            debug << "Frame " << frame << " " << image.width << "x" << image.height
+                << " pass " << done << " in " << seconds * 1000 << "ms" << endl;
+        }
+    }
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "lib/render/shader.hpp"
+
+using namespace std;
+
+namespace irradiance {
+
+    /// Largest interpolation error allowed, smaller is slower and smoother
+    const f32 ACCURACY = 0.25;
+
+    /// Diffuse bounces that gather records, deeper ones only use records there are
+    const u32 BOUNCES = 3;
+
+    /// Hemisphere strata per record, in elevation and azimuth
+    const u32 M = 8;
+    const u32 N = 16;
+
+    /// Bounds on how far a record reaches, before ACCURACY, per unit of distance from the viewer
+    const f32 MIN_RADIUS = 0.2;
+    const f32 MAX_RADIUS = 2;
+
+    /// Half the size of the octree's root, centered on the origin
+    const f32 ROOT = 1024;
+
+    const f32 PI = 3.14159265358979;
+}
+
+/*
+ * Irradiance cache after Ward et al., with the gradients of Ward and
+ * Heckbert. A record holds the mean incoming radiance over the cosine
+ * weighted hemisphere at a point, the harmonic mean distance to the
+ * surfaces it sees, and how the mean changes as the normal rotates and the
+ * point moves, per color channel. Indirect diffuse light varies slowly so
+ * a few records interpolate it over whole surfaces.
+ *
+ * Records live in an octree and are only ever added. Nodes and
+ * records are published with compare and swap, so threads look up and add
+ * records concurrently without locks.
+ */
+class IrradianceCache {
+
+    public:
+        class Record {
+            public:
+                Vec point;
+                Vec normal;
+                Vec value;
+                f32 radius;
+                Vec rotation[3];
+                Vec translation[3];
+                Record * next;
+
+                /* Value extrapolated to point p with normal n. */
+                auto at(const Vec & p, const Vec & n) const -> Vec {
+                    const Vec r = glm::cross(normal, n);
+                    const Vec d = p - point;
+                    Vec v = value;
+                    for(u32 c = 0; c < 3; c++) {
+                        v[c] += glm::dot(rotation[c], r) + glm::dot(translation[c], d);
+                    }
+                    return glm::max(v, vec::zero);
+                }
+        };
+
+        /* A record listed in a node, records are listed in every node they reach into. */
+        class Entry {
+            public:
+                const Record * record;
+                Entry * next;
+        };
+
+        /*
+         * Records are listed in every node of the smallest size at least as
+         * large as their reach that their reach overlaps, at most eight of
+         * them. Looking up a point then only visits the nodes containing it.
+         */
+        class Node {
+            public:
+                Vec center;
+                f32 half;
+                atomic<Node *> children[8];
+                atomic<Entry *> entries;
+
+                Node(const Vec & c, const f32 h) : center(c), half(h), entries(nullptr) {
+                    for(atomic<Node *> & child : children) {
+                        child = nullptr;
+                    }
+                }
+
+                ~Node() {
+                    for(atomic<Node *> & child : children) {
+                        delete child.load();
+                    }
+                    for(Entry * e = entries.load(); e;) {
+                        Entry * next = e->next;
+                        delete e;
+                        e = next;
+                    }
+                }
+
+                auto octant(const Vec & p) const -> u32 {
+                    return (p.x > center.x) | (p.y > center.y) << 1 | (p.z > center.z) << 2;
+                }
+
+                auto contains(const Vec & p, const f32 grow) const -> bool {
+                    const f32 h = half + grow;
+                    return fabs(p.x - center.x) <= h && fabs(p.y - center.y) <= h && fabs(p.z - center.z) <= h;
+                }
+
+                /* Center of the child for octant k. */
+                auto middle(const u32 k) const -> Vec {
+                    const f32 h = half / 2;
+                    return center + Vec((k & 1) ? h : -h, (k & 2) ? h : -h, (k & 4) ? h : -h);
+                }
+
+                /* The child for octant k, made if there is none yet. */
+                auto child(const u32 k) -> Node * {
+                    Node * c = children[k].load();
+                    if(!c) {
+                        Node * made = new Node(middle(k), half / 2);
+                        if(children[k].compare_exchange_strong(c, made)) {
+                            c = made;
+                        } else {
+                            delete made;
+                        }
+                    }
+                    return c;
+                }
+
+                auto push(const Record * record) -> void {
+                    Entry * entry = new Entry { record, entries.load() };
+                    while(!entries.compare_exchange_weak(entry->next, entry)) {}
+                }
+        };
+
+        Node root;
+        atomic<Record *> records;
+        atomic<u32> count;
+
+        IrradianceCache() : root(vec::zero, irradiance::ROOT), records(nullptr), count(0) {}
+
+        ~IrradianceCache() {
+            for(Record * r = records.load(); r;) {
+                Record * next = r->next;
+                delete r;
+                r = next;
+            }
+        }
+
+        auto add(Record * record) -> void {
+            const f32 reach = irradiance::ACCURACY * record->radius;
+            // Records reaching past the root are listed there
+            if(root.half / 2 < reach || !root.contains(record->point, -reach)) {
+                root.push(record);
+            } else {
+                add(root, record, reach);
+            }
+            record->next = records.load();
+            while(!records.compare_exchange_weak(record->next, record)) {}
+            count++;
+            stats::count(stats::RECORDS);
+        }
+
+        auto add(Node & node, const Record * record, const f32 reach) -> void {
+            if(node.half / 2 < reach) {
+                node.push(record);
+                return;
+            }
+            const f32 h = node.half / 2 + reach;
+            for(u32 k = 0; k < 8; k++) {
+                const Vec d = glm::abs(record->point - node.middle(k));
+                if(d.x <= h && d.y <= h && d.z <= h) {
+                    add(*node.child(k), record, reach);
+                }
+            }
+        }
+
+        /*
+         * Interpolate the records around point p with normal n into value.
+         * Returns false when none are close enough.
+         */
+        auto lookup(const Vec & p, const Vec & n, Vec & value) const -> bool {
+            f32 total = 0;
+            Vec sum   = vec::zero;
+            for(const Node * node = &root; node && node->contains(p, 0); node = node->children[node->octant(p)].load()) {
+                lookup(*node, p, n, total, sum);
+            }
+            if(!root.contains(p, 0)) {
+                lookup(root, p, n, total, sum);
+            }
+            if(total > 0) {
+                value = sum / total;
+                return true;
+            }
+            return false;
+        }
+
+        auto lookup(const Node & node, const Vec & p, const Vec & n, f32 & total, Vec & sum) const -> void {
+            for(const Entry * e = node.entries.load(); e; e = e->next) {
+                const Record * r = e->record;
+                const Vec d = p - r->point;
+                const f32 reach = irradiance::ACCURACY * r->radius;
+                if(glm::dot(d, d) >= reach * reach) {
+                    continue;
+                }
+                // Skip records in front of p, they do not see what p sees
+                if(glm::dot(d, r->normal + n) < -0.1 * reach) {
+                    continue;
+                }
+                const f32 error = glm::length(d) / r->radius + sqrt(max(0.f, 1 - glm::dot(n, r->normal)));
+                if(error < irradiance::ACCURACY) {
+                    const f32 w = 1 / max(error, 1e-6f);
+                    sum   += w * r->at(p, n);
+                    total += w;
+                }
+            }
+        }
+};
+
+namespace irradiance {
+
+    mutex lock;
+    map<string, unique_ptr<IrradianceCache>> caches;
+
+    /* The cache of a scene, kept for as long as the program runs. */
+    auto cache(const Scene & scene) -> IrradianceCache & {
+        thread_local const Scene * last = nullptr;
+        thread_local IrradianceCache * found = nullptr;
+        if(&scene != last) {
+            lock_guard<mutex> guard(lock);
+            unique_ptr<IrradianceCache> & c = caches[scene.name];
+            if(!c) {
+                c.reset(new IrradianceCache());
+            }
+            last  = &scene;
+            found = c.get();
+        }
+        return *found;
+    }
+
+    /*
+     * Make a record at point p with normal n by tracing a stratified, cosine
+     * weighted hemisphere of rays, shading what they hit with shader S. The
+     * reach of records grows with their distance from the viewer, so they
+     * are spread about evenly over the image, also towards the horizon.
+     */
+    template<typename S>
+    auto gather(const Vec & p, const Vec & n, const f32 distance, const Scene & scene, const u32 depth) -> IrradianceCache::Record * {
+
+        const Vec u = glm::normalize(glm::cross(fabs(n.x) > 0.9 ? Vec(0, 1, 0) : Vec(1, 0, 0), n));
+        const Vec v = glm::cross(n, u);
+        auto along = [&](const f32 theta, const f32 phi) -> Vec {
+            return u * (cos(phi) * sin(theta)) + v * (sin(phi) * sin(theta)) + n * cos(theta);
+        };
+
+        Vec L[M][N];
+        f32 R[M][N];
+        f32 theta[M][N];
+        Vec mean = vec::zero;
+        f32 inverse = 0;
+
+        for(u32 j = 0; j < M; j++) {
+        for(u32 k = 0; k < N; k++) {
+            theta[j][k] = asin(sqrt((j + frand()) / M));
+            const Ray ray(p, along(theta[j][k], 2 * PI * (k + frand()) / N), 0, shader::SPREAD);
+            Intersection i;
+            stats::ray(depth + 1);
+            if(scene.intersects(ray, body::EPSILON, FLT_MAX, i)) {
+                L[j][k] = S::surface(ray, i, scene, depth + 1);
+                R[j][k] = i.t;
+                inverse += 1 / i.t;
+            } else {
+                L[j][k] = shader::background(ray);
+                R[j][k] = FLT_MAX;
+            }
+            mean += L[j][k];
+        }}
+
+        IrradianceCache::Record * record = new IrradianceCache::Record();
+        record->point  = p;
+        record->normal = n;
+        record->value  = mean / f32(M * N);
+        record->radius = min(max(inverse > 0 ? f32(M * N) / inverse : FLT_MAX, MIN_RADIUS * distance), MAX_RADIUS * distance);
+
+        for(u32 c = 0; c < 3; c++) {
+            record->rotation[c]    = vec::zero;
+            record->translation[c] = vec::zero;
+        }
+        for(u32 k = 0; k < N; k++) {
+
+            const f32 phi   = 2 * PI * (k + 0.5) / N;
+            const f32 phi0  = 2 * PI * k / N;
+            const Vec uk    = along(PI / 2, phi);
+            const Vec vk    = along(PI / 2, phi + PI / 2);
+            const Vec vk0   = along(PI / 2, phi0 + PI / 2);
+            const u32 prior = (k + N - 1) % N;
+
+            for(u32 j = 0; j < M; j++) {
+
+                const f32 low  = asin(sqrt(f32(j) / M));
+                const f32 high = asin(sqrt(f32(j + 1) / M));
+
+                for(u32 c = 0; c < 3; c++) {
+                    record->rotation[c] += vk * (-tan(theta[j][k]) * L[j][k][c]);
+                    record->translation[c] += vk0 * ((cos(low) - cos(high)) / min(R[j][k], R[j][prior]) * (L[j][k][c] - L[j][prior][c]));
+                    if(j > 0) {
+                        record->translation[c] += uk * (2 * PI / N * sin(low) * cos(low) * cos(low) / min(R[j][k], R[j - 1][k]) * (L[j][k][c] - L[j - 1][k][c]));
+                    }
+                }
+            }
+        }
+        // The gradients above are of irradiance, records hold it divided by pi
+        for(u32 c = 0; c < 3; c++) {
+            record->rotation[c]    /= f32(M * N);
+            record->translation[c] /= PI;
+        }
+        return record;
+    }
+}
+
+namespace shader {
+
+    /*
+     * Scatter with the diffuse bounce looked up in the scene's irradiance
+     * cache rather than traced. Where no records are close enough, a new one
+     * is gathered and added for later samples to share. Its rays are shaded
+     * the same way, so every bounce reuses records too, instead of tracing
+     * a whole subtree for every diffuse hit.
+     */
+    struct Irradiance {
+        static auto surface(const Ray & ray, const Intersection & i, const Scene & scene, const u32 depth) -> const Vec {
+            if(depth > MAX_DEPTH) {
+                return vec::zero;
+            }
+
+            Vec color = vec::zero;
+
+            // Diffuse color
+            if(glm::length(i.material->diff) > body::EPSILON) {
+                Vec n = glm::normalize(i.normal);
+                if(glm::dot(n, ray.direction) > 0) {
+                    n = -n;
+                }
+                IrradianceCache & cache = ::irradiance::cache(scene);
+                Vec incoming;
+                if(cache.lookup(i.point, n, incoming)) {
+                    // Interpolated from nearby records
+                } else if(depth <= ::irradiance::BOUNCES) {
+                    IrradianceCache::Record * record = ::irradiance::gather<Irradiance>(i.point, n, i.t, scene, depth);
+                    incoming = record->value;
+                    cache.add(record);
+                } else {
+                    incoming = vec::zero;
+                }
+                color = color + i.material->diff * texture::lookup(ray, i) * incoming;
+            }
+            // Reflection
+            if(glm::length(i.material->refl) > body::EPSILON) {
+                const Vec reflect = vec::reflect(ray.direction, i.normal);
+                color = color + i.material->refl * trace<Irradiance>(bounce(ray, i, reflect + i.material->fuzz * vec::rand()), scene, depth + 1);
+            }
+            return color;
+        }
+    };
+    const Shader irradiance("irradiance", Irradiance::surface);
+}
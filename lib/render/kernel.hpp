@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include "lib/data/tile.hpp"
+#include "lib/render/raster.hpp"
+#include "lib/render/irradiance.hpp"
+#include "lib/render/guide.hpp"
+#include "lib/util/parallel.hpp"
+#include "lib/util/trace.hpp"
+
+using namespace std;
+
+/*
+ * Everything a kernel reads from or writes to while rendering tiles. Passes
+ * after the first reseed every pixel and shift all samples by up to half a
+ * pixel, so averaging passes adds new samples instead of repeating them.
+ * With a G-buffer, primary hits are looked up in it rather than traced.
+ * With a raster, the primary hits of each tile are rasterized before it
+ * renders, into the G-buffer when there is one and otherwise into hits
+ * of the tile alone. Primary rays are cones as wide as a pixel, to
+ * filter textures over.
+ */
+class Job {
+
+    public:
+        const Camera & camera;
+        const Scene  & scene;
+        const Shader & shader;
+        const AA     & aa;
+        FloatBuffer  & buffer;
+        AOVs         & aovs;
+        GBuffer      * gbuffer;
+        const Raster * raster;
+        TileHits visible;
+        u32 pass;
+        u32 seed;
+        f32 du;
+        f32 dv;
+        f32 spread;
+
+        Job(
+            const Camera & c,
+            const Scene  & s,
+            const Shader & h,
+            const AA     & a,
+            FloatBuffer  & b,
+            AOVs         & o,
+            const u32 p = 0,
+            GBuffer * g = nullptr,
+            const Raster * r = nullptr
+        ) : camera(c), scene(s), shader(h), aa(a), buffer(b), aovs(o), gbuffer(g), raster(r), pass(p), seed(rng::SEED), du(0), dv(0),
+            spread(glm::length(c.vrt) / b.height) {
+            if(pass > 0) {
+                const u32 jitter = rng::hash(pass, 0, rng::SEED);
+                seed = rng::hash(pass, 1, rng::SEED);
+                du   = ((jitter & 0xFFFF) / 65536.0 - 0.5) / b.width;
+                dv   = ((jitter >> 16)    / 65536.0 - 0.5) / b.height;
+            }
+        }
+
+        /* The same job rendering a copy s of the scene. */
+        Job(const Job & j, const Scene & s) :
+            camera(j.camera), scene(s), shader(j.shader), aa(j.aa), buffer(j.buffer), aovs(j.aovs), gbuffer(j.gbuffer),
+            raster(j.raster), visible(j.visible), pass(j.pass), seed(j.seed), du(j.du), dv(j.dv), spread(j.spread)
+        {}
+
+        /* Closest hit of ray, primary sample k of pixel x, y. */
+        auto primary(const Ray & ray, const u32 x, const u32 y, const u32 k, Intersection & i) const -> bool {
+            if(gbuffer && k < gbuffer->samples) {
+                return gbuffer->intersects(scene, ray, gbuffer->index(pass, x, y, k), i);
+            }
+            if(visible.hits && k < visible.samples) {
+                return GBuffer::lookup(scene, ray, visible.hits[visible.index(x, y, k)], i);
+            }
+            return scene.intersects(ray, body::EPSILON, FLT_MAX, i);
+        }
+};
+
+typedef void (*Kernel)(const Job &, const Tile &);
+
+typedef function<void(u32)> TileFn;
+
+namespace kernel {
+
+    /*
+     * Render every pixel of tile. S is the shader type and A the anti
+     * aliasing type; with both known at compile time the whole per pixel
+     * path from sampling to shading is made of direct calls.
+     */
+    template<typename S, typename A>
+    auto render(const Job & job, const Tile & tile) -> void {
+        for(u32 y = tile.y0; y < tile.y1; y++) {
+        for(u32 x = tile.x0; x < tile.x1; x++) {
+
+            rng::seed(rng::hash(x, y, job.seed));
+            shadow::pixel();
+            AOVSample primary;
+            u32 k = 0;
+
+            const Vec color = A::alias(x, y, job.buffer, [&](f32 u, f32 v) -> Vec {
+                const Ray ray(job.camera, u + job.du, v + job.dv, job.spread);
+                Intersection i;
+                stats::count(stats::SAMPLES);
+                stats::ray(1);
+                if(job.primary(ray, x, y, k++, i)) {
+                    primary.hit(ray, i);
+                    return S::surface(ray, i, job.scene, 1);
+                }
+                primary.miss(ray);
+                return shader::background(ray);
+            });
+
+            job.buffer.set(x, y, color);
+            job.aovs.set(x, y, primary);
+        }}
+        stats::count(stats::PIXELS, tile.pixels());
+        stats::count(stats::TILES);
+    }
+
+    /* Fallback for shader and AA instances without a specialized kernel. */
+    auto generic(const Job & job, const Tile & tile) -> void {
+        for(u32 y = tile.y0; y < tile.y1; y++) {
+        for(u32 x = tile.x0; x < tile.x1; x++) {
+
+            rng::seed(rng::hash(x, y, job.seed));
+            shadow::pixel();
+            AOVSample primary;
+            u32 k = 0;
+
+            const Vec color = job.aa.alias(x, y, job.buffer, [&](f32 u, f32 v) -> Vec {
+                const Ray ray(job.camera, u + job.du, v + job.dv, job.spread);
+                Intersection i;
+                stats::count(stats::SAMPLES);
+                stats::ray(1);
+                if(job.primary(ray, x, y, k++, i)) {
+                    primary.hit(ray, i);
+                    return job.shader.surface(ray, i, job.scene, 1);
+                }
+                primary.miss(ray);
+                return shader::background(ray);
+            });
+
+            job.buffer.set(x, y, color);
+            job.aovs.set(x, y, primary);
+        }}
+        stats::count(stats::PIXELS, tile.pixels());
+        stats::count(stats::TILES);
+    }
+
+    class Entry {
+        public:
+            string shader;
+            string aa;
+            Kernel fn;
+    };
+
+    template<typename S>
+    auto define(vector<Entry> & table, const Shader & s) -> void {
+        table.push_back(Entry { s.name, aa::none.name,     render<S, aa::None>     });
+        table.push_back(Entry { s.name, aa::centered.name, render<S, aa::Centered> });
+        table.push_back(Entry { s.name, aa::SSAAx4.name,   render<S, aa::SSAA<1>>  });
+        table.push_back(Entry { s.name, aa::SSAAx8.name,   render<S, aa::SSAA<2>>  });
+        table.push_back(Entry { s.name, aa::SSAAx16.name,  render<S, aa::SSAA<4>>  });
+        table.push_back(Entry { s.name, aa::SSAAx32.name,  render<S, aa::SSAA<8>>  });
+        table.push_back(Entry { s.name, aa::SSAAx64.name,  render<S, aa::SSAA<16>> });
+    }
+
+    /* One specialized kernel per built in (shader, AA) pair. */
+    auto table() -> const vector<Entry> & {
+        static vector<Entry> kernels;
+        if(kernels.empty()) {
+            define<shader::Normal> (kernels, shader::normal);
+            define<shader::Scatter>(kernels, shader::scatter);
+            define<shader::Phong>  (kernels, shader::phong);
+            define<shader::Irradiance>(kernels, shader::irradiance);
+            define<shader::Guided>    (kernels, shader::guided);
+        }
+        return kernels;
+    }
+
+    auto get(const Shader & s, const AA & a) -> Kernel {
+        for(const Entry & entry : table()) {
+            if(equal(s.name, entry.shader) && equal(a.name, entry.aa)) {
+                return entry.fn;
+            }
+        }
+        return generic;
+    }
+
+    /*
+     * Render all tiles of job across the worker threads, in order. When
+     * seconds is given it receives the time each tile took, and finished
+     * is called with the index of each tile once it is rendered. Once stop
+     * is set, tiles not started yet are skipped. With --replicate, tiles
+     * render the copy of the scene on the node of their thread.
+     */
+    auto run(
+        const Job & job,
+        const Kernel fn,
+        const vector<Tile> & tiles,
+        vector<f64> * seconds = nullptr,
+        const TileFn & finished = nullptr,
+        const atomic<bool> * stop = nullptr
+    ) -> void {
+        atomic<u32> done(0);
+        if(seconds) {
+            seconds->assign(tiles.size(), 0);
+        }
+        parallel::each(tiles.size(), [&](u32 t) {
+            if(stop && *stop) {
+                return;
+            }
+            const auto start = chrono::steady_clock::now();
+            {
+                const Tile & tile = tiles[t];
+                trace::Span span("tile", TRACING
+                    ? "\"x0\": " + to_string(tile.x0) + ", \"y0\": " + to_string(tile.y0) +
+                      ", \"x1\": " + to_string(tile.x1) + ", \"y1\": " + to_string(tile.y1)
+                    : "");
+                stats::Timer timer(stats::RENDER);
+                Job local(job, scene::local(job.scene));
+                if(job.raster && job.raster->flat() && !(job.gbuffer && job.gbuffer->holds(job.pass, tile))) {
+                    stats::Timer timer(stats::TRACE);
+                    local.visible = job.raster->fill(job.aa, job.buffer, job.du, job.dv, tile);
+                    if(job.gbuffer) {
+                        local.visible.store(*job.gbuffer, job.pass);
+                    }
+                }
+                fn(local, tile);
+                arena::scratch.reset();
+            }
+            if(seconds) {
+                (*seconds)[t] = chrono::duration<f64>(chrono::steady_clock::now() - start).count();
+            }
+            if(finished) {
+                finished(t);
+            }
+            aa::progress(++done, tiles.size());
+        });
+    }
+}
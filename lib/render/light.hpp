@@ -13,10 +13,10 @@ class Light {
 
 namespace light {
 
-    vector<Light> lights;
-
     auto area(const Light & light, const u32 count, const f32 spread) -> vector<Light> {
 
+        vector<Light> lights;
+
         const u32 max = sqrt(count);
         const f32 off = 2 * spread / max;
         const Vec i   = light.intensity * f32(1) / f32(max * max);
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include "lib/render/bvh.hpp"
+#include "lib/render/gbuffer.hpp"
+#include "lib/util/arena.hpp"
+
+using namespace std;
+
+namespace raster {
+
+    /// How a body covers the screen
+    const u32 CULLED   = 0;
+    const u32 POLYGON  = 1;
+    const u32 ANYWHERE = 2;
+
+    /// Screen distance polygons are grown by so no hit on their edges is missed
+    const f32 MARGIN = 1e-4;
+
+    /// Cells across and down the screen that polygons are binned into
+    const u32 GRID = 64;
+
+    /// Cells past which a polygon is not binned but tested by every tile
+    const u32 LARGE = GRID * GRID / 16;
+
+    /* Cell of the grid a screen coordinate falls in, clamped to the screen. */
+    auto cell(const f32 p) -> u32 {
+        return p <= 0 ? 0 : p >= 1 ? GRID - 1 : min(u32(p * GRID), GRID - 1);
+    }
+}
+
+/*
+ * Primary visibility by rasterization. All primary rays leave the camera
+ * origin, so flat bodies can be projected onto the screen once and only
+ * tested against the samples their outline covers, instead of every
+ * sample testing every body. Outlines are binned into a grid over the
+ * screen so each tile only looks at those near it. Bodies that are not
+ * flat, like spheres, and planes, which span the horizon, are traced
+ * through a BVH of their own first. Covered samples then use the body's
+ * own intersection test and, as in the scene's BVH, ties go to the first
+ * body, so the closest hit of each sample is exactly the one tracing
+ * would find.
+ */
+class Raster {
+
+    public:
+        /*
+         * A body projected onto the screen, in the camera's u, v space, as
+         * the bounds and edge functions of its outline. Edge functions are
+         * normalized so they give the distance to each edge, positive inside.
+         */
+        class Shape {
+            public:
+                u32 kind;
+                f32 x0, y0, x1, y1;
+                f32 a[4], b[4], c[4];
+                f32 margin;
+        };
+
+        Camera camera;
+        const Scene & scene;
+        vector<Shape> shapes;
+
+        /// Bodies that do not project to polygons, the ids they have in the scene and a BVH over them
+        vector<Body> others;
+        vector<u32> ids;
+        unique_ptr<WideBVH> tree;
+
+        /// Polygons by cell of the grid, cell c holding binned[cells[c]] to binned[cells[c + 1]], and those too large to bin
+        vector<u32> cells;
+        vector<u32> binned;
+        vector<u32> large;
+
+        Raster(const Camera & cam, const Scene & s) : camera(cam), scene(s), shapes(s.bodies.size()) {
+
+            // Screen coordinates of p solve p - origin = k (w + u hrz + v vrt)
+            const Vec w  = camera.llc - camera.origin;
+            const Vec bw = glm::cross(camera.vrt, w);
+            const Vec wa = glm::cross(w, camera.hrz);
+            const Vec ab = glm::cross(camera.hrz, camera.vrt);
+            const f32 det = glm::dot(camera.hrz, bw);
+
+            for(u32 id = 0; id < shapes.size(); id++) {
+
+                const Body & body = scene.bodies[id];
+                Shape & shape = shapes[id];
+                shape.kind = raster::ANYWHERE;
+
+                if(body.sides < 3) {
+                    continue;
+                }
+                f32 x[4], y[4];
+                u32 front  = 0;
+                u32 behind = 0;
+                for(u32 k = 0; k < body.sides; k++) {
+                    const Vec p = body.corners[k] - camera.origin;
+                    const f32 depth = glm::dot(p, ab) / det;
+                    x[k] = glm::dot(p, bw) / det / depth;
+                    y[k] = glm::dot(p, wa) / det / depth;
+                    front  += depth > 0 && isfinite(x[k]) && isfinite(y[k]);
+                    behind += depth <= 0;
+                }
+                if(behind == body.sides) {
+                    shape.kind = raster::CULLED;
+                    continue;
+                }
+                // Outlines crossing the camera plane do not project to polygons
+                if(front < body.sides) {
+                    continue;
+                }
+                project(shape, x, y, body.sides);
+            }
+
+            for(u32 id = 0; id < shapes.size(); id++) {
+                if(shapes[id].kind == raster::ANYWHERE) {
+                    others.push_back(scene.bodies[id]);
+                    ids.push_back(id);
+                }
+            }
+            if(!others.empty()) {
+                tree.reset(new WideBVH(others));
+            }
+            bin();
+        }
+
+        Raster(const Raster &) = delete;
+        auto operator=(const Raster &) -> Raster & = delete;
+
+        /* Whether any body projects to a polygon, without which rasterizing is only tracing. */
+        auto flat() const -> bool {
+            return !binned.empty() || !large.empty();
+        }
+
+        /* Sort the polygons into the cells of the grid their bounds overlap. */
+        auto bin() -> void {
+
+            cells.assign(raster::GRID * raster::GRID + 1, 0);
+            auto each = [&](const function<void(u32, u32)> & fn) {
+                for(u32 id = 0; id < shapes.size(); id++) {
+                    const Shape & shape = shapes[id];
+                    if(shape.kind != raster::POLYGON) {
+                        continue;
+                    }
+                    const u32 cx0 = raster::cell(shape.x0), cx1 = raster::cell(shape.x1);
+                    const u32 cy0 = raster::cell(shape.y0), cy1 = raster::cell(shape.y1);
+                    if((cx1 - cx0 + 1) * (cy1 - cy0 + 1) > raster::LARGE) {
+                        fn(id, raster::GRID * raster::GRID);
+                        continue;
+                    }
+                    for(u32 cy = cy0; cy <= cy1; cy++) {
+                    for(u32 cx = cx0; cx <= cx1; cx++) {
+                        fn(id, cy * raster::GRID + cx);
+                    }}
+                }
+            };
+
+            // Count, then place, the polygons of every cell
+            each([&](u32, u32 c) {
+                if(c < raster::GRID * raster::GRID) {
+                    cells[c + 1]++;
+                }
+            });
+            for(u32 c = 0; c < raster::GRID * raster::GRID; c++) {
+                cells[c + 1] += cells[c];
+            }
+            binned.resize(cells.back());
+            vector<u32> next(cells.begin(), cells.end() - 1);
+            each([&](u32 id, u32 c) {
+                if(c < raster::GRID * raster::GRID) {
+                    binned[next[c]++] = id;
+                } else {
+                    large.push_back(id);
+                }
+            });
+        }
+
+        /* Fill in the bounds and edge functions of a convex outline. */
+        static auto project(Shape & shape, const f32 * x, const f32 * y, const u32 sides) -> void {
+
+            f32 area = 0;
+            f32 extent = 0;
+            for(u32 k = 0; k < sides; k++) {
+                const u32 j = (k + 1) % sides;
+                area += x[k] * y[j] - x[j] * y[k];
+                extent = max(extent, max(fabs(x[k]), fabs(y[k])));
+            }
+            const f32 orientation = area < 0 ? -1 : 1;
+
+            shape.kind   = raster::POLYGON;
+            shape.margin = raster::MARGIN * (1 + extent);
+            shape.x0 = *min_element(x, x + sides) - shape.margin;
+            shape.y0 = *min_element(y, y + sides) - shape.margin;
+            shape.x1 = *max_element(x, x + sides) + shape.margin;
+            shape.y1 = *max_element(y, y + sides) + shape.margin;
+
+            for(u32 k = 0; k < 4; k++) {
+                shape.a[k] = shape.b[k] = shape.c[k] = 0;
+                if(k >= sides) {
+                    continue;
+                }
+                const u32 j = (k + 1) % sides;
+                const f32 length = sqrt((x[j] - x[k]) * (x[j] - x[k]) + (y[j] - y[k]) * (y[j] - y[k]));
+                if(length > 0) {
+                    shape.a[k] = -orientation * (y[j] - y[k]) / length;
+                    shape.b[k] =  orientation * (x[j] - x[k]) / length;
+                    shape.c[k] = -(shape.a[k] * x[k] + shape.b[k] * y[k]);
+                }
+            }
+        }
+
+        /*
+         * Find the closest hit of every primary sample of tile, as the
+         * kernel will sample them, into hits carved from the scratch arena.
+         */
+        auto fill(
+            const AA & aa,
+            const FloatBuffer & buffer,
+            const f32 du,
+            const f32 dv,
+            const Tile & tile
+        ) const -> TileHits {
+
+            const u32 n     = aa.samples;
+            const u32 width = tile.x1 - tile.x0;
+            const usize count = usize(tile.pixels()) * n;
+
+            // Samples of the tile, row by row, in the order the AA takes them, freed with the tile
+            Arena & scratch = arena::scratch;
+            f32 * us      = scratch.array<f32>(count);
+            f32 * vs      = scratch.array<f32>(count);
+            Ray * rays    = scratch.array<Ray>(count);
+            f32 * ts      = scratch.array<f32>(count, FLT_MAX);
+            u32 * ids     = scratch.array<u32>(count, gbuffer::MISS);
+            u8  * covered = scratch.array<u8>(count);
+
+            for(u32 y = tile.y0; y < tile.y1; y++) {
+            for(u32 x = tile.x0; x < tile.x1; x++) {
+                const usize first = (usize(y - tile.y0) * width + (x - tile.x0)) * n;
+                u32 k = 0;
+                aa.alias(x, y, buffer, [&](f32 u, f32 v) -> Vec {
+                    if(k < n) {
+                        us[first + k]   = u + du;
+                        vs[first + k]   = v + dv;
+                        rays[first + k] = Ray(camera, u + du, v + dv);
+                    }
+                    k++;
+                    return vec::zero;
+                });
+            }}
+            const f32 u0 = *min_element(us, us + count);
+            const f32 u1 = *max_element(us, us + count);
+            const f32 v0 = *min_element(vs, vs + count);
+            const f32 v1 = *max_element(vs, vs + count);
+
+            // Bodies that do not project are traced, which leaves the polygons to beat their hits
+            if(tree) {
+                for(usize s = 0; s < count; s++) {
+                    Intersection i;
+                    if(tree->intersects(rays[s], body::EPSILON, FLT_MAX, i)) {
+                        ts[s]  = i.t;
+                        ids[s] = this->ids[i.id];
+                    }
+                }
+            }
+
+            // Polygons binned in the cells the tile's samples fall in, each once, in scene order
+            const u32 cx0 = raster::cell(u0), cx1 = raster::cell(u1);
+            const u32 cy0 = raster::cell(v0), cy1 = raster::cell(v1);
+            usize most = large.size();
+            for(u32 cy = cy0; cy <= cy1; cy++) {
+                most += cells[cy * raster::GRID + cx1 + 1] - cells[cy * raster::GRID + cx0];
+            }
+            u32 * near = scratch.array<u32>(most);
+            u32 * end  = copy(large.begin(), large.end(), near);
+            for(u32 cy = cy0; cy <= cy1; cy++) {
+                end = copy(binned.begin() + cells[cy * raster::GRID + cx0], binned.begin() + cells[cy * raster::GRID + cx1 + 1], end);
+            }
+            sort(near, end);
+            end = unique(near, end);
+
+            // A hit at the same t as the closest so far wins when its body comes first
+            auto test = [&](const Body & body, const u32 id, const usize s) {
+                Intersection i;
+                if(body.intersects(rays[s], body::EPSILON, nextafter(ts[s], FLT_MAX), i) && (i.t < ts[s] || id < ids[s])) {
+                    ts[s]  = i.t;
+                    ids[s] = id;
+                }
+            };
+
+            for(const u32 * at = near; at < end; at++) {
+
+                const u32 id = *at;
+                const Shape & shape = shapes[id];
+                const Body  & body  = scene.bodies[id];
+
+                if(shape.x1 < u0 || shape.x0 > u1 || shape.y1 < v0 || shape.y0 > v1) {
+                    continue;
+                }
+
+                // Pixels whose samples may fall within the bounds, samples lie within a pixel of their corner
+                const u32 px0 = clamp(floor((f64(shape.x0) - du) * buffer.width)  - 1, tile.x0, tile.x1);
+                const u32 px1 = clamp(floor((f64(shape.x1) - du) * buffer.width)  + 2, tile.x0, tile.x1);
+                const u32 py0 = clamp(floor((f64(shape.y0) - dv) * buffer.height) - 1, tile.y0, tile.y1);
+                const u32 py1 = clamp(floor((f64(shape.y1) - dv) * buffer.height) + 2, tile.y0, tile.y1);
+
+                for(u32 y = py0; y < py1; y++) {
+
+                    const usize first = (usize(y - tile.y0) * width + (px0 - tile.x0)) * n;
+                    const usize last  = (usize(y - tile.y0) * width + (px1 - tile.x0)) * n;
+
+                    // Half space test of the whole row, free of branches so it vectorizes
+                    for(usize s = first; s < last; s++) {
+                        f32 inside = FLT_MAX;
+                        for(u32 e = 0; e < 4; e++) {
+                            inside = min(inside, shape.a[e] * us[s] + shape.b[e] * vs[s] + shape.c[e]);
+                        }
+                        covered[s] = inside >= -shape.margin;
+                    }
+                    for(usize s = first; s < last; s++) {
+                        if(covered[s]) {
+                            test(body, id, s);
+                        }
+                    }
+                }
+            }
+
+            const TileHits found(tile, n, scratch.array<GBuffer::Hit>(count));
+            for(usize s = 0; s < count; s++) {
+                found.hits[s] = ids[s] == gbuffer::MISS
+                    ? GBuffer::Hit { gbuffer::MISS, 0 }
+                    : GBuffer::Hit { ids[s], ts[s] };
+            }
+            return found;
+        }
+
+        /* Clamp a pixel coordinate computed in screen space to [lo, hi]. */
+        static auto clamp(const f64 p, const u32 lo, const u32 hi) -> u32 {
+            return p < lo ? lo : p > hi ? hi : u32(p);
+        }
+};
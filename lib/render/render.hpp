@@ -0,0 +1,108 @@
+#pragma once
+
+#include "lib/render/kernel.hpp"
+#include "lib/render/schedule.hpp"
+#include "lib/render/checkpoint.hpp"
+
+using namespace std;
+
+/*
+ * Render scene from camera at res into a linear float image, rendering
+ * tiles in the given order. When seconds is given it receives the time
+ * each tile took.
+ */
+auto render(
+    const Resolution & res,
+    const Camera & camera,
+    const Scene & scene,
+    const Shader & shader,
+    const AA & aa,
+    AOVs & aovs,
+    const vector<Tile> & tiles,
+    vector<f64> * seconds = nullptr,
+    GBuffer * gbuffer = nullptr,
+    const Raster * raster = nullptr
+) -> const FloatBuffer {
+    FloatBuffer buffer(res.width, res.height);
+    const Job job(camera, scene, shader, aa, buffer, aovs, 0, gbuffer, raster);
+    kernel::run(job, kernel::get(shader, aa), tiles, seconds);
+    return buffer;
+}
+
+auto render(
+    const Resolution & res,
+    const Camera & camera,
+    const Scene & scene,
+    const Shader & shader,
+    const AA & aa,
+    AOVs & aovs
+) -> const FloatBuffer {
+    return render(res, camera, scene, shader, aa, aovs, tile::split(res.width, res.height));
+}
+
+/*
+ * Render the remaining passes of progress, skipping tiles it has already
+ * finished, and return the average of all completed passes. Primary hits
+ * are cached in gbuffer when one is given, and rasterized with raster.
+ */
+auto render(
+    const Camera & camera,
+    const Scene & scene,
+    const Shader & shader,
+    const AA & aa,
+    AOVs & aovs,
+    Checkpoint & progress,
+    GBuffer * gbuffer = nullptr,
+    const Raster * raster = nullptr
+) -> const FloatBuffer {
+
+    const Kernel fn = kernel::get(shader, aa);
+    progress.restore(aovs);
+
+    while(progress.pass < progress.passes) {
+
+        trace::Span span("pass", TRACING ? "\"pass\": " + to_string(progress.pass) : "");
+        const vector<u32> todo = progress.todo();
+
+        // A pass picked up part way through was already begun when it started
+        if(shader.begin && todo.size() == progress.tiles.size()) {
+            shader.begin(scene);
+        }
+        FloatBuffer buffer = progress.buffer();
+        const Job job(camera, scene, shader, aa, buffer, aovs, progress.pass, gbuffer, raster);
+
+        vector<Tile> tiles;
+        for(const u32 t : todo) {
+            tiles.push_back(progress.tiles[t]);
+        }
+        kernel::run(job, fn, tiles, nullptr, [&](u32 t) {
+            progress.finish(todo[t], buffer, aovs);
+        }, progress.stop);
+        if(progress.stopped()) {
+            break;
+        }
+        progress.next(buffer);
+    }
+    return progress.image();
+}
+
+/*
+ * Render a preview, measuring how long each small region of it takes to
+ * render into costs so the full render can be scheduled.
+ */
+auto preview(
+    const Resolution & res,
+    const Camera & camera,
+    const Scene & scene,
+    const Shader & shader,
+    CostMap & costs,
+    GBuffer * gbuffer = nullptr,
+    const Raster * raster = nullptr
+) -> const FloatBuffer {
+    AOVs none;
+    vector<f64> seconds;
+    const vector<Tile> tiles = tile::split(res.width, res.height, schedule::CELL);
+    const FloatBuffer image  = render(res, camera, scene, shader, aa::none, none, tiles, &seconds, gbuffer, raster);
+    costs = CostMap(res.width, res.height, tiles, seconds);
+    return image;
+}
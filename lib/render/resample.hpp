@@ -0,0 +1,154 @@
+#pragma once
+
+#include "lib/data/floatbuffer.hpp"
+#include "lib/data/resolution.hpp"
+#include "lib/util/parallel.hpp"
+
+using namespace std;
+
+/*
+ * Separable Lanczos resampling of a finished render into other sizes. The
+ * image is filtered in linear light, first along rows and then along
+ * columns, with the weights of every output pixel worked out once per
+ * axis. When shrinking, the filter is stretched by the ratio of the sizes
+ * so every input pixel contributes and nothing aliases. Channels are
+ * split into planes so the inner loops run over contiguous floats and
+ * vectorize well.
+ */
+namespace resample {
+
+    /// Lobes of the Lanczos window either side of a sample
+    const u32 LOBES = 3;
+
+    auto sinc(const f32 x) -> f32 {
+        if(fabs(x) < 1e-6) {
+            return 1;
+        }
+        const f32 p = PI * x;
+        return sin(p) / p;
+    }
+
+    auto lanczos(const f32 x) -> f32 {
+        return fabs(x) < LOBES ? sinc(x) * sinc(x / LOBES) : 0;
+    }
+
+    /* For every output sample of one axis, the first input it reads and its weights. */
+    class Taps {
+        public:
+            u32 size;
+            vector<u32> first;
+            vector<f32> weights;
+    };
+
+    /* Taps resampling n samples into m, weights summing to one. */
+    auto taps(const u32 n, const u32 m) -> Taps {
+
+        const f32 ratio  = f32(n) / m;
+        const f32 scale  = max(ratio, 1.0f);
+        const f32 radius = LOBES * scale;
+
+        Taps t;
+        t.size = min(u32(ceil(radius)) * 2 + 1, n);
+        t.first.resize(m);
+        t.weights.resize(usize(m) * t.size);
+
+        for(u32 o = 0; o < m; o++) {
+
+            // Pixel centers are at half pixels, the window is moved inside the edges
+            const f32 center = (o + 0.5f) * ratio;
+            const i32 first  = min(max(i32(floor(center - radius)), 0), i32(n - t.size));
+            f32 * w = &t.weights[usize(o) * t.size];
+            f32 sum = 0;
+            for(u32 k = 0; k < t.size; k++) {
+                w[k] = lanczos((first + k + 0.5f - center) / scale);
+                sum += w[k];
+            }
+            for(u32 k = 0; k < t.size; k++) {
+                w[k] /= sum;
+            }
+            t.first[o] = first;
+        }
+        return t;
+    }
+
+    /* Resample image to width by height. */
+    auto resize(const FloatBuffer & image, const u32 width, const u32 height) -> FloatBuffer {
+
+        const u32 w = image.width;
+        const u32 h = image.height;
+        const Taps across = taps(w, width);
+        const Taps down   = taps(h, height);
+
+        Plane in[3], rows[3], out[3];
+        for(u32 k = 0; k < 3; k++) {
+            in[k].resize(usize(w) * h);
+            rows[k].resize(usize(width) * h);
+            out[k].resize(usize(width) * height);
+        }
+        for(usize p = 0; p < image.data.size(); p++) {
+            for(u32 k = 0; k < 3; k++) {
+                in[k][p] = image.data[p][k];
+            }
+        }
+
+        // Along rows, each output pixel reads a contiguous span of its row
+        parallel::each(h, [&](u32 y) {
+            for(u32 k = 0; k < 3; k++) {
+                const f32 * src = &in[k][usize(y) * w];
+                f32 * dst = &rows[k][usize(y) * width];
+                for(u32 x = 0; x < width; x++) {
+                    const f32 * wt = &across.weights[usize(x) * across.size];
+                    const f32 * s  = src + across.first[x];
+                    f32 sum = 0;
+                    for(u32 t = 0; t < across.size; t++) {
+                        sum += wt[t] * s[t];
+                    }
+                    dst[x] = sum;
+                }
+            }
+        });
+
+        // Down columns, each output row is a weighted sum of whole rows
+        parallel::each(height, [&](u32 y) {
+            const f32 * wt = &down.weights[usize(y) * down.size];
+            for(u32 k = 0; k < 3; k++) {
+                f32 * dst = &out[k][usize(y) * width];
+                for(u32 t = 0; t < down.size; t++) {
+                    const f32 * src = &rows[k][usize(down.first[y] + t) * width];
+                    const f32 weight = wt[t];
+                    for(u32 x = 0; x < width; x++) {
+                        dst[x] += weight * src[x];
+                    }
+                }
+            }
+        });
+
+        FloatBuffer resized(width, height);
+        for(usize p = 0; p < resized.data.size(); p++) {
+            resized.data[p] = Vec(out[0][p], out[1][p], out[2][p]);
+        }
+        return resized;
+    }
+
+    /* An extra size to write the render at (--also-out). */
+    class Target {
+        public:
+            Resolution res;
+            string path;
+    };
+
+    /* Format of path by its extension, or fallback. */
+    auto format(const string & path, const string & fallback) -> string {
+        const usize dot = path.find_last_of('.');
+        const string ext = dot == string::npos ? "" : path.substr(dot + 1);
+        return equal(ext, "bmp") || equal(ext, "ppm") ? ext : fallback;
+    }
+
+    /* Write image at every target size. */
+    auto out(const FloatBuffer & image, const vector<Target> & targets, const string & fallback) -> void {
+        for(const Target & target : targets) {
+            resize(image, target.res.width, target.res.height).out(format(target.path, fallback), target.path);
+            debug << "Wrote " << target.res.width << "x" << target.res.height << " to " << target.path << endl;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "lib/data/tile.hpp"
+#include "lib/util/parallel.hpp"
+
+using namespace std;
+
+/*
+ * Per pixel render cost measured while rendering the preview. Costs are kept
+ * as a summed area table so the cost of any region, in normalized image
+ * coordinates, can be looked up in constant time.
+ */
+class CostMap {
+
+    public:
+        u32 width;
+        u32 height;
+        vector<f64> sums;
+
+        CostMap() : width(0), height(0) {}
+
+        /* Spread each tile's measured seconds evenly over its pixels. */
+        CostMap(const u32 w, const u32 h, const vector<Tile> & tiles, const vector<f64> & seconds) :
+            width(w),
+            height(h),
+            sums((w + 1) * (h + 1), 0)
+        {
+            vector<f64> cost(w * h, 0);
+            for(usize t = 0; t < tiles.size(); t++) {
+                const Tile & tile = tiles[t];
+                for(u32 y = tile.y0; y < tile.y1; y++) {
+                for(u32 x = tile.x0; x < tile.x1; x++) {
+                    cost[y * w + x] = seconds[t] / tile.pixels();
+                }}
+            }
+            for(u32 y = 0; y < h; y++) {
+            for(u32 x = 0; x < w; x++) {
+                sums[(y + 1) * (w + 1) + x + 1] = cost[y * w + x]
+                    + sums[y * (w + 1) + x + 1]
+                    + sums[(y + 1) * (w + 1) + x]
+                    - sums[y * (w + 1) + x];
+            }}
+        }
+
+        auto empty() const -> bool {
+            return width == 0 || height == 0;
+        }
+
+        /* Relative cost of the region [u0, u1) x [v0, v1) of the image. */
+        auto cost(const f32 u0, const f32 v0, const f32 u1, const f32 v1) const -> f64 {
+            const u32 x0 = min(u32(u0 * width),  width - 1);
+            const u32 y0 = min(u32(v0 * height), height - 1);
+            const u32 x1 = max(min(u32(ceil(u1 * width)),  width),  x0 + 1);
+            const u32 y1 = max(min(u32(ceil(v1 * height)), height), y0 + 1);
+            const f64 sum = sums[y1 * (width + 1) + x1]
+                - sums[y0 * (width + 1) + x1]
+                - sums[y1 * (width + 1) + x0]
+                + sums[y0 * (width + 1) + x0];
+            // Scale by the fraction of the looked up cells the region covers
+            const f64 area = f64(u1 - u0) * width * f64(v1 - v0) * height;
+            return sum * area / ((x1 - x0) * (y1 - y0));
+        }
+};
+
+namespace schedule {
+
+    /// Tile size used to measure the preview's cost map
+    const u32 CELL = 4;
+
+    /// Smallest tile expensive regions are split into
+    const u32 MIN_TILE = 8;
+
+    /// Aim for about this many tiles worth of work per thread
+    const u32 TILES_PER_THREAD = 16;
+
+    /*
+     * Plan the given tiles of a w x h render from costs measured by the
+     * preview. Tiles costing more than an even share of the work are split
+     * into quarters, and the result is ordered most expensive first so the
+     * slowest tiles start early instead of forming a long tail.
+     */
+    auto plan(const vector<Tile> & tiles, const u32 w, const u32 h, const CostMap & costs) -> vector<Tile> {
+
+        if(costs.empty()) {
+            return tiles;
+        }
+
+        auto cost = [&](const Tile & t) -> f64 {
+            return costs.cost(f32(t.x0) / w, f32(t.y0) / h, f32(t.x1) / w, f32(t.y1) / h);
+        };
+
+        f64 total = 0;
+        for(const Tile & t : tiles) {
+            total += cost(t);
+        }
+        const f64 share = total / (parallel::threads() * TILES_PER_THREAD);
+
+        vector<Tile> todo = tiles;
+        vector<pair<f64, Tile>> planned;
+
+        while(!todo.empty()) {
+
+            const Tile t = todo.back();
+            const f64 c  = cost(t);
+            const u32 tw = t.x1 - t.x0;
+            const u32 th = t.y1 - t.y0;
+            todo.pop_back();
+
+            if(c > share && (tw > MIN_TILE || th > MIN_TILE)) {
+                const u32 xm = tw > MIN_TILE ? t.x0 + tw / 2 : t.x1;
+                const u32 ym = th > MIN_TILE ? t.y0 + th / 2 : t.y1;
+                todo.push_back(Tile(t.x0, t.y0, xm, ym));
+                if(xm < t.x1)             todo.push_back(Tile(xm, t.y0, t.x1, ym));
+                if(ym < t.y1)             todo.push_back(Tile(t.x0, ym, xm, t.y1));
+                if(xm < t.x1 && ym < t.y1) todo.push_back(Tile(xm, ym, t.x1, t.y1));
+            } else {
+                planned.push_back(make_pair(c, t));
+            }
+        }
+
+        stable_sort(planned.begin(), planned.end(), [](const pair<f64, Tile> & a, const pair<f64, Tile> & b) {
+            return a.first > b.first;
+        });
+
+        vector<Tile> ordered;
+        for(const pair<f64, Tile> & p : planned) {
+            ordered.push_back(p.second);
+        }
+        return ordered;
+    }
+
+    auto plan(const u32 w, const u32 h, const CostMap & costs, const u32 size = tile::SIZE) -> vector<Tile> {
+        return plan(tile::split(w, h, size), w, h, costs);
+    }
+}
@@ -1,19 +1,58 @@
 #pragma once
 
+#include "lib/render/shadow.hpp"
+
 using namespace std;
 
-typedef function<const Vec(const Ray &, const Scene &, const u32)> ShaderFn;
+typedef function<const Vec(const Ray &, const Intersection &, const Scene &, const u32)> SurfaceFn;
+
+typedef function<void(const Scene &)> PassFn;
 
 class Shader;
-namespace shader { vector<Shader*> shaders; }
 
+namespace shader {
+
+    vector<Shader*> shaders;
+
+    /// Widening of the cone of a diffuse bounce, which may head anywhere over the hemisphere
+    const f32 SPREAD = 0.2;
+
+    /* Ray leaving the hit i of ray towards d, continuing its cone widened by spread. */
+    auto bounce(const Ray & ray, const Intersection & i, const Vec & d, const f32 spread = 0) -> Ray {
+        return Ray(i.point, d, ray.width + ray.spread * i.t, ray.spread + spread);
+    }
+
+    auto background(const Ray & ray) -> const Vec {
+        f32 t = 0.5 * ray.direction.y + 1;
+        return (f32)(1.0 - t) * Vec(1.0, 1.0, 1.0) + t * Vec(0.5, 0.7, 1.0);
+    }
+
+    /* Trace ray into the scene and shade the closest hit with surface. */
+    auto trace(const SurfaceFn & surface, const Ray & ray, const Scene & scene, const u32 depth) -> const Vec {
+        Intersection i;
+        stats::ray(depth);
+        if(scene.intersects(ray, body::EPSILON, FLT_MAX, i)) {
+            return surface(ray, i, scene, depth);
+        }
+        return background(ray);
+    }
+}
+
+/*
+ * Shaders are split into tracing and shading. The surface function only
+ * colors an intersection that has already been found, which lets the
+ * renderer reuse a primary hit (eg. for AOVs) instead of tracing it twice.
+ * Shaders that learn from what earlier passes traced are told when every
+ * progressive pass begins, once, even if it is stopped and picked up again.
+ */
 class Shader {
 
     public:
         string name;
-        ShaderFn shade;
+        SurfaceFn surface;
+        PassFn begin;
 
-        Shader(const string & n, const ShaderFn & s) : name(n), shade(s) {
+        Shader(const string & n, const SurfaceFn & s, const PassFn & b = nullptr) : name(n), surface(s), begin(b) {
             shader::shaders.push_back(this);
         }
 
@@ -22,7 +61,7 @@ class Shader {
             const Scene & scene,
             const u32 depth
         ) const -> const Vec {
-            return shade(ray, scene, depth);
+            return shader::trace(surface, ray, scene, depth);
         }
 };
 
@@ -31,7 +70,7 @@ namespace shader {
     const u32 MAX_DEPTH = 16;
 
 
-    auto get(const string & name) -> const Shader {
+    auto get(const string & name) -> const Shader & {
         for(const Shader* shader: shaders) {
             if(equal(name, (*shader).name)) {
                 return *shader;
@@ -40,99 +79,113 @@ namespace shader {
         fail(name + " is not a valid shader name.");
     }
 
-    auto background(const Ray & ray) -> const Vec {
-        f32 t = 0.5 * ray.direction.y + 1;
-        return (f32)(1.0 - t) * Vec(1.0, 1.0, 1.0) + t * Vec(0.5, 0.7, 1.0);
-    }
-
 }
 
 namespace shader {
 
-    const ShaderFn normalShader = [](const Ray & ray, const Scene & scene, const u32 depth) -> const Vec {
-
+    /*
+     * Trace ray into the scene and shade the closest hit with S::surface.
+     * Shaders recurse through this template so the call is direct and can
+     * be inlined, unlike a SurfaceFn.
+     */
+    template<typename S>
+    auto trace(const Ray & ray, const Scene & scene, const u32 depth) -> const Vec {
         Intersection i;
-        if(scene.world.intersects(ray, body::EPSILON, FLT_MAX, i)) {
+        stats::ray(depth);
+        if(scene.intersects(ray, body::EPSILON, FLT_MAX, i)) {
+            return S::surface(ray, i, scene, depth);
+        }
+        return background(ray);
+    }
+
+    struct Normal {
+        static auto surface(const Ray &, const Intersection & i, const Scene &, const u32) -> const Vec {
             return (f32)(0.5) * Vec(
                 i.normal.x + 1,
                 i.normal.y + 1,
                 i.normal.z + 1
             );
         }
-        return background(ray);
     };
-    const Shader normal("normal", normalShader);
-
-    const ShaderFn scatterShader = [](const Ray & ray, const Scene & scene, const u32 depth) -> const Vec {
-            Intersection i;
+    const Shader normal("normal", Normal::surface);
 
-            if(scene.world.intersects(ray, body::EPSILON, FLT_MAX, i)) {
-                if(depth > MAX_DEPTH) {
-                    return vec::zero;
-                }
+    struct Scatter {
+        static auto surface(const Ray & ray, const Intersection & i, const Scene & scene, const u32 depth) -> const Vec {
+            if(depth > MAX_DEPTH) {
+                return vec::zero;
+            }
 
-                const Vec off     = vec::rand();
-                const Vec target  = i.point + i.normal + off;
-                const Vec reflect = vec::reflect(ray.direction, i.normal);
+            const Vec off     = vec::rand();
+            const Vec target  = i.point + i.normal + off;
+            const Vec reflect = vec::reflect(ray.direction, i.normal);
 
-                Vec color = vec::zero;
+            Vec color = vec::zero;
 
-                // Diffuse color
-                if(glm::length(i.material.diff) > body::EPSILON) {
-                    color = color + i.material.diff * scatterShader(Ray(i.point, target - i.point), scene, depth + 1);
-                }
-                // Reflection
-                if(glm::length(i.material.refl) > body::EPSILON) {
-                    color = color + i.material.refl * scatterShader(Ray(i.point, reflect + i.material.fuzz * off), scene, depth + 1);
-                }
-                return color;
+            // Diffuse color
+            if(glm::length(i.material->diff) > body::EPSILON) {
+                color = color + i.material->diff * texture::lookup(ray, i)
+                    * trace<Scatter>(bounce(ray, i, target - i.point, SPREAD), scene, depth + 1);
+            }
+            // Reflection
+            if(glm::length(i.material->refl) > body::EPSILON) {
+                color = color + i.material->refl * trace<Scatter>(bounce(ray, i, reflect + i.material->fuzz * off), scene, depth + 1);
             }
-            return background(ray);
+            return color;
+        }
     };
-    const Shader scatter("scatter", scatterShader);
+    const Shader scatter("scatter", Scatter::surface);
 
-    auto ambient(const Intersection & i) -> Vec {
-        return material::AMBIENT * i.material.amb;
+    auto ambient(const Intersection & i, const Vec & texel) -> Vec {
+        return material::AMBIENT * i.material->amb * texel;
     }
 
-    auto diffuse(const Intersection & i, const Light & light, const Vec & l, const Vec & f) -> Vec {
-        return vec::cclamp(light.intensity * i.material.diff * glm::dot(f, l));
+    auto diffuse(const Intersection & i, const Vec & texel, const Light & light, const Vec & l, const Vec & f) -> Vec {
+        return vec::cclamp(light.intensity * i.material->diff * texel * glm::dot(f, l));
     }
 
     auto specular(const Ray & ray, const Intersection & i, const Light & light, const Vec & l) -> Vec {
         Vec h = glm::normalize(l - ray.direction);
-        return vec::cclamp(light.intensity * i.material.spec * pow(glm::dot(i.normal, h), i.material.specpow));
+        return vec::cclamp(light.intensity * i.material->spec * pow(glm::dot(i.normal, h), i.material->specpow));
     }
 
-    const ShaderFn phongShader = [](const Ray & ray, const Scene & scene, const u32 depth) -> const Vec {
+    struct Phong {
+        static auto surface(const Ray & ray, const Intersection & i, const Scene & scene, const u32 depth) -> const Vec {
 
-            Intersection i, tmp;
+            Intersection tmp;
 
             Vec color(0, 0, 0);
 
-            if(scene.world.intersects(ray, body::EPSILON, FLT_MAX, i)) {
-                if(depth > MAX_DEPTH) {
-                    return color;
-                }
-                const Vec fuzz = glm::normalize(i.normal + i.material.fuzz * vec::rand());
-                color = color + ambient(i);
-
-                for(const Light & light : scene.lights) {
-                    Vec l   = light.point - i.point;
-                    f32 max = glm::length(l);
-                    l       = glm::normalize(l);
-                    if(!scene.world.intersects(Ray(i.point, l), body::EPSILON, max, tmp)) {
-                        color = color
-                            + diffuse(i, light, l, fuzz)
-                            + specular(ray, i, light, l);
-                    }
-                }
-                if(glm::length(i.material.refl) > body::EPSILON) {
-                    color += i.material.refl * phongShader(Ray(i.point, vec::reflect(ray.direction, fuzz)), scene, depth + 1);
-                }
+            if(depth > MAX_DEPTH) {
                 return color;
             }
-            return background(ray);
+            const Vec fuzz  = glm::normalize(i.normal + i.material->fuzz * vec::rand());
+            const Vec texel = texture::lookup(ray, i);
+            color = color + ambient(i, texel);
+
+            // Primary hits may reuse what earlier samples of the pixel saw
+            const bool reuse = shadow::REUSE && depth == 1;
+            const u32 lights = scene.lights.size();
+
+            for(u32 k = 0; k < lights; k++) {
+                const Light & light = scene.lights[k];
+                Vec l   = light.point - i.point;
+                f32 max = glm::length(l);
+                l       = glm::normalize(l);
+                auto visible = [&]() -> bool {
+                    stats::count(stats::SHADOW);
+                    return !scene.intersects(Ray(i.point, l), body::EPSILON, max, tmp);
+                };
+                if(reuse ? shadow::cache.visible(i.id, k, lights, visible) : visible()) {
+                    color = color
+                        + diffuse(i, texel, light, l, fuzz)
+                        + specular(ray, i, light, l);
+                }
+            }
+            if(glm::length(i.material->refl) > body::EPSILON) {
+                color += i.material->refl * trace<Phong>(bounce(ray, i, vec::reflect(ray.direction, fuzz)), scene, depth + 1);
+            }
+            return color;
+        }
     };
-    const Shader phong("phong", phongShader);
-}
\ No newline at end of file
+    const Shader phong("phong", Phong::surface);
+}
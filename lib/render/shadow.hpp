@@ -0,0 +1,99 @@
+#pragma once
+
+#include "lib/core.hpp"
+#include "lib/util/memory.hpp"
+#include "lib/util/stats.hpp"
+
+using namespace std;
+
+namespace shadow {
+
+    /// Reuse the shadow rays of earlier samples of a pixel (--shadow-cache)
+    bool REUSE = false;
+
+    /// Bodies a pixel remembers visibility for
+    const u32 BODIES = 4;
+
+    /// Samples that have to agree on a light before it is reused
+    const u32 AGREE = 2;
+
+    /// Every this many reuses the shadow ray is traced anyway, to find edges earlier samples missed
+    const u32 PROBE = 8;
+}
+
+/*
+ * Light visibility from the primary hits of the pixel being rendered, per
+ * body hit and light. Anti aliased pixels take many samples that mostly
+ * hit the same body and see the same lights, so once the first samples on
+ * a body agree whether a light is visible, later samples take their word
+ * for it. A body and light that samples disagree on straddle a shadow
+ * edge and are always traced, and reused answers are checked every so
+ * often so edges the first samples missed are still found.
+ */
+class ShadowCache {
+
+    public:
+        class Tally {
+            public:
+                u8 lit;
+                u8 dark;
+                u8 reused;
+        };
+
+        class Seen {
+            public:
+                u32 id;
+                vector<Tally, memory::Tracked<Tally, memory::SCRATCH>> lights;
+        };
+
+        Seen seen[shadow::BODIES];
+        u32 used = 0;
+
+        auto reset() -> void {
+            used = 0;
+        }
+
+        /*
+         * Whether light, of lights, is visible from a hit on body id. Trace
+         * is called to find out when earlier samples cannot tell.
+         */
+        template<typename F>
+        auto visible(const u32 id, const u32 light, const u32 lights, const F & trace) -> bool {
+
+            Seen * s = nullptr;
+            for(u32 k = 0; k < used && !s; k++) {
+                s = seen[k].id == id ? &seen[k] : nullptr;
+            }
+            if(!s && used < shadow::BODIES) {
+                s = &seen[used++];
+                s->id = id;
+                s->lights.assign(lights, Tally { 0, 0, 0 });
+            }
+            if(!s) {
+                return trace();
+            }
+            Tally & t = s->lights[light];
+            if((t.lit >= shadow::AGREE && !t.dark) || (t.dark >= shadow::AGREE && !t.lit)) {
+                if(++t.reused % shadow::PROBE) {
+                    stats::count(stats::SHADOW_REUSED);
+                    return t.lit > 0;
+                }
+            }
+            const bool lit = trace();
+            u8 & count = lit ? t.lit : t.dark;
+            count = count < 255 ? count + 1 : count;
+            return lit;
+        }
+};
+
+namespace shadow {
+
+    thread_local ShadowCache cache;
+
+    /* Forget the visibility seen by the previous pixel. */
+    auto pixel() -> void {
+        if(REUSE) {
+            cache.reset();
+        }
+    }
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "lib/data/buffer.hpp"
+#include "lib/data/ray.hpp"
+#include "lib/data/intersection.hpp"
+#include "lib/util/memory.hpp"
+#include "lib/util/stats.hpp"
+#include "lib/util/arena.hpp"
+
+using namespace std;
+
+namespace texture {
+
+    const string MAGIC = "RAYNTEX1";
+
+    /// Texels along the side of a tile, tiles are read from disk whole
+    const u32 TILE = 64;
+    const usize TILE_BYTES = TILE * TILE * 3;
+
+    /// Bytes of tiles the cache keeps in memory (--texture-cache)
+    usize BUDGET = usize(256) << 20;
+
+    /// Independently locked parts of the cache, and tiles each thread keeps at hand
+    const u32 SHARDS = 16;
+    const u32 MEMO   = 8;
+
+    /// Footprints are never taken to be narrower than this cosine allows
+    const f32 GRAZING = 0.05;
+
+    /* Decode an 8-bit texel, stored gamma corrected like images, to linear. */
+    auto linear(const u8 c) -> f32 {
+        static const array<f32, 256> table = []() {
+            array<f32, 256> t;
+            for(u32 k = 0; k < 256; k++) {
+                t[k] = pow(k / 255.0, 1 / color::GAMMA);
+            }
+            return t;
+        }();
+        return table[c];
+    }
+
+    /* Where procedural scenes keep the textures they generate. */
+    auto scratch(const string & name) -> string {
+        const char * dir = getenv("TEMP");
+        dir = dir ? dir : getenv("TMPDIR");
+        return string(dir ? dir : "/tmp") + "/rayn-" + name + ".tex";
+    }
+}
+
+typedef vector<u8, memory::Tracked<u8, memory::TEXTURES>> TileBytes;
+typedef shared_ptr<const TileBytes> TileData;
+
+/*
+ * Texture tiles shared by every texture and thread, least recently used
+ * first out once they take up more than texture::BUDGET bytes. Each shard
+ * of the key space has its own lock and list, so threads fetching other
+ * tiles rarely wait for each other. Tiles are read from disk without
+ * holding a lock; if two threads read the same tile, one copy is kept.
+ * Tiles still in use when evicted are freed once their last user lets go.
+ */
+class TileCache {
+
+    public:
+        class Entry {
+            public:
+                TileData tile;
+                list<u64>::iterator at;
+        };
+
+        class Shard {
+            public:
+                mutex lock;
+                list<u64> order;
+                unordered_map<u64, Entry> entries;
+                usize bytes = 0;
+        };
+
+        Shard shards[texture::SHARDS];
+
+        /* The tile for key, read with load if it is not in memory. */
+        template<typename F>
+        auto get(const u64 key, const F & load) -> TileData {
+
+            Shard & shard = shards[(key * 0x9E3779B97F4A7C15ull) >> 60 & (texture::SHARDS - 1)];
+            {
+                lock_guard<mutex> guard(shard.lock);
+                const auto found = shard.entries.find(key);
+                if(found != shard.entries.end()) {
+                    shard.order.splice(shard.order.begin(), shard.order, found->second.at);
+                    return found->second.tile;
+                }
+            }
+            const TileData tile = load();
+            stats::count(stats::TEXTURE_TILES);
+
+            lock_guard<mutex> guard(shard.lock);
+            const auto found = shard.entries.find(key);
+            if(found != shard.entries.end()) {
+                return found->second.tile;
+            }
+            shard.order.push_front(key);
+            shard.entries[key] = Entry { tile, shard.order.begin() };
+            shard.bytes += tile->size();
+            while(shard.bytes > texture::BUDGET / texture::SHARDS && shard.order.size() > 1) {
+                Entry & last = shard.entries[shard.order.back()];
+                shard.bytes -= last.tile->size();
+                shard.entries.erase(shard.order.back());
+                shard.order.pop_back();
+            }
+            return tile;
+        }
+
+        auto bytes() -> usize {
+            usize total = 0;
+            for(Shard & shard : shards) {
+                lock_guard<mutex> guard(shard.lock);
+                total += shard.bytes;
+            }
+            return total;
+        }
+};
+
+namespace texture {
+
+    auto cache() -> TileCache & {
+        static TileCache tiles;
+        return tiles;
+    }
+
+    atomic<u32> ids(1);
+}
+
+/*
+ * An image texture streamed from a file written by texture::convert. The
+ * file holds the image and every halved mip level down to a single texel,
+ * each cut into TILE x TILE tiles of 8-bit RGB stored one after the other.
+ * Only the header stays in memory, tiles are fetched through the shared
+ * TileCache as lookups need them, so large texture sets only cost memory
+ * for the parts and levels actually seen.
+ */
+class Texture {
+
+    public:
+        class Level {
+            public:
+                u32 width;
+                u32 height;
+                u32 tiles;
+                u64 offset;
+        };
+
+        string path;
+        u32 id;
+        vector<Level> levels;
+        mutable ifstream file;
+        mutable mutex lock;
+
+        Texture(const string & p) : path(p), id(texture::ids++), file(p, ios::binary) {
+
+            if(!file) {
+                fail("Could not open " + path + ".");
+            }
+            string magic(texture::MAGIC.size(), ' ');
+            u32 count = 0;
+            file.read(&magic[0], magic.size());
+            file.read((char *) &count, sizeof(count));
+            if(!file || !equal(magic, texture::MAGIC) || count == 0 || count > 32) {
+                fail(path + " is not a texture, convert images with rayn texture.");
+            }
+            levels.resize(count);
+            for(Level & level : levels) {
+                file.read((char *) &level.width,  sizeof(level.width));
+                file.read((char *) &level.height, sizeof(level.height));
+                file.read((char *) &level.offset, sizeof(level.offset));
+                level.tiles = (level.width + texture::TILE - 1) / texture::TILE;
+            }
+            if(!file) {
+                fail("Could not read " + path + ".");
+            }
+        }
+
+        Texture(const Texture &) = delete;
+        auto operator=(const Texture &) -> Texture & = delete;
+
+        /* Read tile tx, ty of level l from disk. */
+        auto load(const u32 l, const u32 tx, const u32 ty) const -> TileData {
+            const Level & level = levels[l];
+            shared_ptr<TileBytes> tile = make_shared<TileBytes>(texture::TILE_BYTES);
+            lock_guard<mutex> guard(lock);
+            file.seekg(level.offset + (u64(ty) * level.tiles + tx) * texture::TILE_BYTES);
+            file.read((char *) tile->data(), tile->size());
+            if(!file) {
+                fail("Could not read " + path + ".");
+            }
+            return tile;
+        }
+
+        /*
+         * Linear color of texel x, y of level l. The last few tiles each
+         * thread used are kept at hand, since neighbouring lookups mostly
+         * land in the same tiles and need not lock the cache.
+         */
+        auto texel(const u32 l, const u32 x, const u32 y) const -> Vec {
+
+            thread_local u64 keys[texture::MEMO] = {};
+            thread_local TileData tiles[texture::MEMO];
+
+            const u32 tx = x / texture::TILE;
+            const u32 ty = y / texture::TILE;
+            const u64 key = u64(id) << 40 | u64(l) << 32 | (ty * levels[l].tiles + tx);
+            const u32 slot = (key ^ key >> 29) % texture::MEMO;
+
+            if(keys[slot] != key) {
+                tiles[slot] = texture::cache().get(key, [&]() { return load(l, tx, ty); });
+                keys[slot]  = key;
+            }
+            const u8 * c = tiles[slot]->data() + ((y % texture::TILE) * texture::TILE + x % texture::TILE) * 3;
+            return Vec(texture::linear(c[0]), texture::linear(c[1]), texture::linear(c[2]));
+        }
+
+        /* Bilinear lookup of level l, repeating the texture beyond [0, 1]. */
+        auto bilinear(const u32 l, const f32 u, const f32 v) const -> Vec {
+
+            const Level & level = levels[l];
+            const f32 x = (u - floor(u)) * level.width  - 0.5;
+            const f32 y = (v - floor(v)) * level.height - 0.5;
+            const f32 fx = x - floor(x);
+            const f32 fy = y - floor(y);
+            const i32 x0 = floor(x);
+            const i32 y0 = floor(y);
+            const u32 xa = (x0 + level.width)  % level.width;
+            const u32 ya = (y0 + level.height) % level.height;
+            const u32 xb = (xa + 1) % level.width;
+            const u32 yb = (ya + 1) % level.height;
+
+            return (texel(l, xa, ya) * (1 - fx) + texel(l, xb, ya) * fx) * (1 - fy)
+                 + (texel(l, xa, yb) * (1 - fx) + texel(l, xb, yb) * fx) * fy;
+        }
+
+        /*
+         * Color at u, v filtered over footprint, the width in uv units that
+         * a lookup stands for. The mip level is picked so a texel is about
+         * as wide as the footprint, blending the two nearest levels.
+         */
+        auto sample(const f32 u, const f32 v, const f32 footprint) const -> Vec {
+            const f32 lod = log2(max(footprint * max(levels[0].width, levels[0].height), f32(1)));
+            const u32 l   = min(u32(lod), u32(levels.size() - 1));
+            const f32 f   = lod - l;
+            if(l + 1 >= levels.size() || f <= 0) {
+                return bilinear(l, u, v);
+            }
+            return bilinear(l, u, v) * (1 - f) + bilinear(l + 1, u, v) * f;
+        }
+};
+
+namespace texture {
+
+    /*
+     * Convert image into a texture file at path. Each mip level averages
+     * 2x2 texels of the one before it in linear color, and every level is
+     * cut into tiles, padded with the edge texels of the level.
+     */
+    auto convert(const Buffer & image, const string & path) -> void {
+
+        auto decode = [](const Color & c) -> Vec {
+            return Vec(linear(c.r), linear(c.g), linear(c.b));
+        };
+
+        vector<vector<Vec>> mips(1, vector<Vec>(image.data.size()));
+        vector<Texture::Level> levels(1, Texture::Level { image.width, image.height, 0, 0 });
+        transform(image.data.begin(), image.data.end(), mips[0].begin(), decode);
+
+        while(levels.back().width > 1 || levels.back().height > 1) {
+            const Texture::Level & from = levels.back();
+            const Texture::Level to { max(from.width / 2, u32(1)), max(from.height / 2, u32(1)), 0, 0 };
+            vector<Vec> mip(usize(to.width) * to.height);
+            for(u32 y = 0; y < to.height; y++) {
+            for(u32 x = 0; x < to.width;  x++) {
+                const u32 x0 = min(x * 2, from.width - 1), x1 = min(x * 2 + 1, from.width - 1);
+                const u32 y0 = min(y * 2, from.height - 1), y1 = min(y * 2 + 1, from.height - 1);
+                const vector<Vec> & m = mips.back();
+                mip[y * to.width + x] = (m[y0 * from.width + x0] + m[y0 * from.width + x1]
+                                       + m[y1 * from.width + x0] + m[y1 * from.width + x1]) / f32(4);
+            }}
+            levels.push_back(to);
+            mips.push_back(move(mip));
+        }
+
+        u64 offset = MAGIC.size() + sizeof(u32) + levels.size() * (2 * sizeof(u32) + sizeof(u64));
+        for(Texture::Level & level : levels) {
+            level.tiles  = (level.width + TILE - 1) / TILE;
+            level.offset = offset;
+            offset += u64(level.tiles) * ((level.height + TILE - 1) / TILE) * TILE_BYTES;
+        }
+
+        const string tmp = path + ".tmp";
+        {
+            ofstream fs(tmp, ios::binary);
+            const u32 count = levels.size();
+            fs.write(MAGIC.data(), MAGIC.size());
+            fs.write((const char *) &count, sizeof(count));
+            for(const Texture::Level & level : levels) {
+                fs.write((const char *) &level.width,  sizeof(level.width));
+                fs.write((const char *) &level.height, sizeof(level.height));
+                fs.write((const char *) &level.offset, sizeof(level.offset));
+            }
+            vector<u8> tile(TILE_BYTES);
+            for(u32 l = 0; l < levels.size(); l++) {
+                const Texture::Level & level = levels[l];
+                for(u32 ty = 0; ty * TILE < level.height; ty++) {
+                for(u32 tx = 0; tx < level.tiles; tx++) {
+                    for(u32 y = 0; y < TILE; y++) {
+                    for(u32 x = 0; x < TILE; x++) {
+                        const u32 sx = min(tx * TILE + x, level.width - 1);
+                        const u32 sy = min(ty * TILE + y, level.height - 1);
+                        const Color c(mips[l][sy * level.width + sx]);
+                        u8 * t = tile.data() + (y * TILE + x) * 3;
+                        t[0] = c.r;
+                        t[1] = c.g;
+                        t[2] = c.b;
+                    }}
+                    fs.write((const char *) tile.data(), tile.size());
+                }}
+            }
+            if(!fs) {
+                fail("Could not write " + tmp + ".");
+            }
+        }
+        remove(path.c_str());
+        rename(tmp.c_str(), path.c_str());
+    }
+
+    /* A texture owned by the current arena, eg. the one of the scene being built. */
+    auto open(const string & path) -> const Texture * {
+        return arena::make<Texture>(path);
+    }
+
+    /*
+     * Color the texture of the material hit by ray multiplies its colors
+     * by, white for untextured materials. The footprint is the width of
+     * the ray's cone where it hit, in uv units, stretched where the ray
+     * grazes the surface.
+     */
+    auto lookup(const Ray & ray, const Intersection & i) -> Vec {
+        const Texture * texture = i.material->texture;
+        if(!texture) {
+            return Vec(1, 1, 1);
+        }
+        const f32 width  = ray.width + ray.spread * i.t;
+        const f32 cosine = max(fabs(glm::dot(ray.direction, i.normal)) / glm::length(ray.direction), GRAZING);
+        return texture->sample(i.u, i.v, width / (i.scale * cosine));
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include "lib/core.hpp"
+#include "lib/util/memory.hpp"
+
+using namespace std;
+
+/*
+ * Bump allocator. Objects are carved out of large blocks one after another
+ * and are all freed at once when the arena is reset or destroyed, running
+ * the destructors of non trivial objects in reverse order. An arena is not
+ * thread safe; each thread allocates from its own or from one it was
+ * handed while nothing else uses it. Blocks are charged to the arena's
+ * memory tag, apart from objects of types with a tag of their own.
+ */
+class Arena {
+
+    public:
+        /// Size of each block, larger allocations get a block of their own
+        static const usize BLOCK = 1 << 16;
+
+        class Block {
+            public:
+                unique_ptr<u8[]> data;
+                usize size;
+        };
+
+        class Destructor {
+            public:
+                void * object;
+                void (*destroy)(void *);
+        };
+
+        vector<Block> blocks;
+        vector<Destructor> destructors;
+        usize used;
+        u32 tag;
+        usize moved[memory::TAGS] = {};
+
+        Arena(const u32 t = memory::GEOMETRY) : used(0), tag(t) {}
+
+        Arena(const Arena &) = delete;
+        auto operator=(const Arena &) -> Arena & = delete;
+
+        ~Arena() {
+            destroy();
+            memory::remove(tag, bytes());
+        }
+
+        auto allocate(const usize bytes, const usize align) -> void * {
+            usize offset = (used + align - 1) & ~(align - 1);
+            if(blocks.empty() || offset + bytes > blocks.back().size) {
+                const usize size = max(bytes, BLOCK);
+                memory::add(tag, size);
+                blocks.push_back(Block { unique_ptr<u8[]>(new u8[size]), size });
+                offset = 0;
+            }
+            // Blocks from new[] are aligned for any fundamental type
+            used = offset + bytes;
+            return blocks.back().data.get() + offset;
+        }
+
+        /* Construct a T in the arena. */
+        template<typename T, typename... Args>
+        auto make(Args &&... args) -> T * {
+            T * object = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+            const u32 t = memory::Tag<T>::value;
+            if(t != memory::ANY && t != tag) {
+                memory::move(tag, t, sizeof(T));
+                moved[t] += sizeof(T);
+            }
+            if(!is_trivially_destructible<T>::value) {
+                destructors.push_back(Destructor { object, [](void * o) { static_cast<T *>(o)->~T(); } });
+            }
+            return object;
+        }
+
+        /*
+         * Space for n copies of value in the arena. Only for types with
+         * nothing to destroy, as arrays are not given destructors.
+         */
+        template<typename T>
+        auto array(const usize n, const T & value = T()) -> T * {
+            static_assert(is_trivially_destructible<T>::value, "Arena arrays are never destroyed.");
+            T * items = static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+            uninitialized_fill_n(items, n, value);
+            return items;
+        }
+
+        /*
+         * Free everything at once. Blocks are merged into one as large as
+         * all of them, so an arena reset after every tile soon stops
+         * allocating.
+         */
+        auto reset() -> void {
+            destroy();
+            if(blocks.size() > 1) {
+                const usize all = bytes();
+                blocks.clear();
+                blocks.push_back(Block { unique_ptr<u8[]>(new u8[all]), all });
+            }
+            used = 0;
+        }
+
+        /* Run the destructors of all objects and give their tags' bytes back to the arena's. */
+        auto destroy() -> void {
+            for(auto d = destructors.rbegin(); d != destructors.rend(); d++) {
+                d->destroy(d->object);
+            }
+            destructors.clear();
+            for(u32 t = 0; t < memory::TAGS; t++) {
+                memory::move(t, tag, moved[t]);
+                moved[t] = 0;
+            }
+        }
+
+        /* Bytes held in blocks. */
+        auto bytes() const -> usize {
+            usize total = 0;
+            for(const Block & b : blocks) {
+                total += b.size;
+            }
+            return total;
+        }
+};
+
+namespace arena {
+
+    /// Arena long lived data (eg. a scene being built) is allocated from
+    thread_local shared_ptr<Arena> current;
+
+    /// Per thread scratch space for the temporaries of a tile, reset after every tile
+    thread_local Arena scratch(memory::SCRATCH);
+
+    /* Make a the current arena for the lifetime of the scope. */
+    class Scope {
+
+        public:
+            shared_ptr<Arena> previous;
+
+            Scope(const shared_ptr<Arena> & a) : previous(current) {
+                current = a;
+            }
+
+            ~Scope() {
+                current = previous;
+            }
+    };
+
+    /* Arena used outside of any scope, freed when the program exits. */
+    auto global() -> Arena & {
+        static Arena a;
+        return a;
+    }
+
+    template<typename T, typename... Args>
+    auto make(Args &&... args) -> T * {
+        return (current ? *current : global()).make<T>(forward<Args>(args)...);
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include "lib/core.hpp"
+#include "lib/util/stats.hpp"
+
+using namespace std;
+
+/*
+ * A minimal benchmark harness. Each benchmark is a function that performs a
+ * given number of operations and returns how many rays it traced (or zero).
+ * Iterations are doubled until a run takes at least MIN_SECONDS, and the best
+ * of REPEATS such runs is reported as one line of JSON.
+ */
+namespace bench {
+
+    const f64 MIN_SECONDS = 0.2;
+    const u32 REPEATS     = 3;
+    const u32 SEED        = 305;
+
+    typedef function<u64(u64 iterations)> BenchFn;
+
+    /// Sink for benchmark results so the optimizer cannot drop the work
+    volatile f32 sink = 0;
+
+    auto consume(const Vec & v) -> void {
+        sink = sink + v.x + v.y + v.z;
+    }
+
+    auto consume(const f32 f) -> void {
+        sink = sink + f;
+    }
+
+    class Result {
+
+        public:
+            string name;
+            u64 iterations;
+            u64 rays;
+            f64 seconds;
+
+            auto json() const -> string {
+                stringstream stream;
+                stream << "{\"bench\": \"" << name << "\""
+                    << ", \"iterations\": " << iterations
+                    << ", \"seconds\": "    << seconds
+                    << ", \"ns_per_op\": "  << seconds * 1e9 / iterations;
+                if(rays) {
+                    stream << ", \"rays\": " << rays
+                        << ", \"mrays_per_s\": " << f64(rays) / seconds / 1e6;
+                }
+                stream << "}";
+                return stream.str();
+            }
+    };
+
+    /* Rays traced by one call of op, counted with statistics on. */
+    auto traced(const function<void()> & op) -> u64 {
+
+        STATS = true;
+        const stats::Counters before = stats::merged();
+        rng::seed(SEED);
+        op();
+        const stats::Counters after = stats::merged();
+        STATS = false;
+
+        u64 rays = 0;
+        for(const u32 k : { stats::PRIMARY, stats::SECONDARY, stats::SHADOW }) {
+            rays += after.counts[k] - before.counts[k];
+        }
+        return rays;
+    }
+
+    auto time(const BenchFn & fn, const u64 iterations, u64 & rays) -> f64 {
+        const auto start = chrono::steady_clock::now();
+        rays = fn(iterations);
+        return chrono::duration<f64>(chrono::steady_clock::now() - start).count();
+    }
+
+    /* Run fn, or only count it once when fixed (eg. for whole renders). */
+    auto run(const string & name, const BenchFn & fn, const bool fixed = false) -> Result {
+
+        u64 iterations = 1;
+        u64 rays       = 0;
+
+        if(!fixed) {
+            while(rng::seed(SEED), time(fn, iterations, rays) < MIN_SECONDS / 4) {
+                iterations *= 2;
+            }
+        }
+
+        Result best { name, iterations, 0, FLT_MAX };
+        for(u32 r = 0; r < REPEATS; r++) {
+            rng::seed(SEED);
+            const f64 seconds = time(fn, iterations, rays);
+            if(seconds < best.seconds) {
+                best.seconds = seconds;
+                best.rays    = rays;
+            }
+        }
+        return best;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "lib/core.hpp"
+
+using namespace std;
+
+/*
+ * A file of a fixed size mapped into memory and shared with any other
+ * process mapping it, so writes show up there without any I/O calls.
+ */
+class MappedFile {
+
+    public:
+        u8 * data;
+        usize size;
+#ifdef _WIN32
+        HANDLE file;
+        HANDLE mapping;
+#else
+        i32 file;
+#endif
+
+        MappedFile(const string & path, const usize s) : data(nullptr), size(s) {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            mapping = file == INVALID_HANDLE_VALUE ? nullptr
+                : CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(u64(size) >> 32), DWORD(size), nullptr);
+            data = mapping ? (u8 *) MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+#else
+            file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(file >= 0 && ftruncate(file, size) == 0) {
+                void * p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+                data = p == MAP_FAILED ? nullptr : (u8 *) p;
+            }
+#endif
+            if(!data) {
+                fail("Could not map " + path + ".");
+            }
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        auto operator=(const MappedFile &) -> MappedFile & = delete;
+
+        ~MappedFile() {
+#ifdef _WIN32
+            UnmapViewOfFile(data);
+            CloseHandle(mapping);
+            CloseHandle(file);
+#else
+            munmap(data, size);
+            close(file);
+#endif
+        }
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <iomanip>
+#include <mutex>
+#include "lib/core.hpp"
+
+using namespace std;
+
+class Material;
+class Texture;
+
+/*
+ * Bytes held per subsystem, now and at their peak. Long lived allocations
+ * are charged to a tag when made and discharged when freed, either by the
+ * Tracked allocator of the containers that hold them, by the arenas they
+ * are carved from, or by their owner. Counts are shared by all threads.
+ */
+namespace memory {
+
+    /// Tags
+    const u32 GEOMETRY     = 0;
+    const u32 MATERIALS    = 1;
+    const u32 LIGHTS       = 2;
+    const u32 ACCELERATION = 3;
+    const u32 FRAMEBUFFERS = 4;
+    const u32 SCRATCH      = 5;
+    const u32 TEXTURES     = 6;
+    const u32 TAGS         = 7;
+
+    const vector<string> NAMES = {
+        "geometry", "materials", "lights", "acceleration",
+        "framebuffers", "scratch", "textures"
+    };
+
+    /// Bytes all tags together may hold before giving up, no limit when 0 (--mem-limit)
+    usize LIMIT = 0;
+
+    atomic<i64> current[TAGS];
+    atomic<i64> peak[TAGS];
+    atomic<i64> total(0);
+    atomic<i64> highest(0);
+
+    auto raise(atomic<i64> & p, const i64 bytes) -> void {
+        i64 seen = p.load();
+        while(bytes > seen && !p.compare_exchange_weak(seen, bytes)) {}
+    }
+
+    /* Bytes in MB, or KB when less than one MB. */
+    auto readable(const f64 bytes) -> string {
+        stringstream stream;
+        stream << fixed << setprecision(1);
+        if(bytes < (1 << 20)) {
+            stream << bytes / (1 << 10) << "KB";
+        } else {
+            stream << bytes / (1 << 20) << "MB";
+        }
+        return stream.str();
+    }
+
+    /// Set once going over --mem-limit stopped threads, which take no new work after it
+    atomic<bool> exceeded(false);
+    atomic<u32> sharing(0);
+    string reason;
+    mutex lock;
+
+    /*
+     * Charge bytes to tag. Going over --mem-limit fails right away, naming
+     * the subsystem that asked, rather than leaving the system to kill the
+     * render once memory runs out. While threads run, failing would exit
+     * under them, so they are stopped instead and the thread that started
+     * them fails once they are done (see check).
+     */
+    auto add(const u32 tag, const usize bytes) -> void {
+        raise(peak[tag], current[tag] += bytes);
+        const i64 all = total += bytes;
+        raise(highest, all);
+        if(LIMIT && usize(all) > LIMIT) {
+            const string why = "Out of memory: " + NAMES[tag] + " needed " + readable(bytes) + " more, taking the total to "
+                + readable(all) + " over the --mem-limit of " + readable(LIMIT) + ".";
+            if(!sharing) {
+                fail(why);
+            }
+            lock_guard<mutex> guard(lock);
+            if(!exceeded) {
+                reason = why;
+                exceeded = true;
+            }
+        }
+    }
+
+    /* Fail if going over the limit stopped the threads, once none of them are left running. */
+    auto check() -> void {
+        if(exceeded && !sharing) {
+            fail(reason);
+        }
+    }
+
+    /* Marks threads as running for as long as it lives, see add. */
+    class Sharing {
+        public:
+            Sharing() {
+                sharing++;
+            }
+
+            ~Sharing() {
+                sharing--;
+            }
+    };
+
+    auto remove(const u32 tag, const usize bytes) -> void {
+        current[tag] -= bytes;
+        total -= bytes;
+    }
+
+    /* Move bytes already charged from one tag to another. */
+    auto move(const u32 from, const u32 to, const usize bytes) -> void {
+        current[from] -= bytes;
+        raise(peak[to], current[to] += bytes);
+    }
+
+    /// Tag of objects of a type made in an arena, that of the arena when ANY
+    const u32 ANY = TAGS;
+
+    template<typename T>
+    class Tag {
+        public:
+            static const u32 value = ANY;
+    };
+
+    template<>
+    class Tag<Material> {
+        public:
+            static const u32 value = MATERIALS;
+    };
+
+    template<>
+    class Tag<Texture> {
+        public:
+            static const u32 value = TEXTURES;
+    };
+
+    /* Allocator for standard containers that charges what they hold to TAG. */
+    template<typename T, u32 TAG>
+    class Tracked {
+
+        public:
+            typedef T value_type;
+
+            template<typename U>
+            class rebind {
+                public:
+                    typedef Tracked<U, TAG> other;
+            };
+
+            Tracked() {}
+
+            template<typename U>
+            Tracked(const Tracked<U, TAG> &) {}
+
+            auto allocate(const usize n) -> T * {
+                add(TAG, n * sizeof(T));
+                return static_cast<T *>(::operator new(n * sizeof(T)));
+            }
+
+            auto deallocate(T * p, const usize n) -> void {
+                remove(TAG, n * sizeof(T));
+                ::operator delete(p);
+            }
+    };
+
+    template<typename T, typename U, u32 TAG>
+    auto operator==(const Tracked<T, TAG> &, const Tracked<U, TAG> &) -> bool {
+        return true;
+    }
+
+    template<typename T, typename U, u32 TAG>
+    auto operator!=(const Tracked<T, TAG> &, const Tracked<U, TAG> &) -> bool {
+        return false;
+    }
+
+    /* Report current and peak bytes per tag as text or json. */
+    auto report(const string & format) -> string {
+
+        stringstream stream;
+
+        if(equal(format, "json")) {
+            stream << "{";
+            for(u32 t = 0; t < TAGS; t++) {
+                stream << "\"" << NAMES[t] << "\": {\"current\": " << current[t] << ", \"peak\": " << peak[t] << "}, ";
+            }
+            stream << "\"total\": {\"current\": " << total << ", \"peak\": " << highest << "}}";
+            return stream.str();
+        }
+
+        stream << "[Memory]" << endl;
+        for(u32 t = 0; t < TAGS; t++) {
+            stream << " " << left << setw(18) << (toupper(NAMES[t]) + ":")
+                << readable(current[t]) << " (peak " << readable(peak[t]) << ")" << endl;
+        }
+        stream << " " << left << setw(18) << "TOTAL:" << readable(total) << " (peak " << readable(highest) << ")";
+        return stream.str();
+    }
+}
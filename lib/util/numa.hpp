@@ -0,0 +1,199 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <thread>
+#include "lib/core.hpp"
+
+using namespace std;
+
+/*
+ * NUMA topology and thread placement. Memory is placed on the node of the
+ * thread that first touches it, so once threads are pinned the per tile
+ * buffers they carve from their scratch arenas, and scenes built by a
+ * thread pinned to a node, stay local to where they are used.
+ */
+namespace numa {
+
+    /// Pin worker threads to cores (--affinity)
+    bool AFFINITY = false;
+
+    /// Build a copy of the scene on every node (--replicate)
+    bool REPLICATE = false;
+
+    /// Node of the current thread once it is pinned
+    thread_local u32 current = 0;
+
+    /* Parse a cpulist like 0-3,8-11. */
+    auto parse(const string & list) -> vector<u32> {
+        vector<u32> cpus;
+        stringstream stream(list);
+        string range;
+        while(getline(stream, range, ',')) {
+            const usize dash = range.find('-');
+            if(range.find_first_of("0123456789") == string::npos) {
+                continue;
+            }
+            const u32 first = atoi(range.substr(0, dash).c_str());
+            const u32 last  = dash == string::npos ? first : atoi(range.substr(dash + 1).c_str());
+            for(u32 cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    /* Cpus of every node. Without NUMA there is one node of all cpus. */
+    auto nodes() -> const vector<vector<u32>> & {
+        static const vector<vector<u32>> all = []() {
+            vector<vector<u32>> found;
+#ifdef _WIN32
+            ULONG highest = 0;
+            if(GetNumaHighestNodeNumber(&highest)) {
+                for(u32 node = 0; node <= highest; node++) {
+                    ULONGLONG mask = 0;
+                    vector<u32> cpus;
+                    if(GetNumaNodeProcessorMask(UCHAR(node), &mask)) {
+                        for(u32 cpu = 0; cpu < 64; cpu++) {
+                            if(mask >> cpu & 1) {
+                                cpus.push_back(cpu);
+                            }
+                        }
+                    }
+                    if(!cpus.empty()) {
+                        found.push_back(cpus);
+                    }
+                }
+            }
+#elif defined(__linux__)
+            for(u32 node = 0;; node++) {
+                ifstream fs("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+                string list;
+                if(!fs || !getline(fs, list)) {
+                    break;
+                }
+                const vector<u32> cpus = parse(list);
+                if(!cpus.empty()) {
+                    found.push_back(cpus);
+                }
+            }
+#endif
+            if(found.empty()) {
+                const u32 n = max(thread::hardware_concurrency(), 1u);
+                found.push_back(vector<u32>());
+                for(u32 cpu = 0; cpu < n; cpu++) {
+                    found.back().push_back(cpu);
+                }
+            }
+            return found;
+        }();
+        return all;
+    }
+
+    /*
+     * Cpus in the order workers are pinned to them, taking one core of each
+     * node in turn so any number of workers is split evenly between nodes.
+     */
+    auto order() -> const vector<pair<u32, u32>> & {
+        static const vector<pair<u32, u32>> all = []() {
+            vector<pair<u32, u32>> cpus;
+            usize widest = 0;
+            for(const vector<u32> & node : nodes()) {
+                widest = max(widest, node.size());
+            }
+            for(u32 k = 0; k < widest; k++) {
+            for(u32 node = 0; node < nodes().size(); node++) {
+                if(k < nodes()[node].size()) {
+                    cpus.push_back(make_pair(node, nodes()[node][k]));
+                }
+            }}
+            return cpus;
+        }();
+        return all;
+    }
+
+    /*
+     * Restrict the calling thread to cpus, which all belong to node. Cpus
+     * past what an affinity mask holds, 64 on Windows without processor
+     * groups, are left out, and the thread is left alone if none remain.
+     */
+    auto bind(const vector<u32> & cpus, const u32 node) -> void {
+#ifdef _WIN32
+        DWORD_PTR mask = 0;
+        for(const u32 cpu : cpus) {
+            if(cpu < sizeof(mask) * 8) {
+                mask |= DWORD_PTR(1) << cpu;
+            }
+        }
+        if(mask) {
+            SetThreadAffinityMask(GetCurrentThread(), mask);
+        }
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(const u32 cpu : cpus) {
+            if(cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if(CPU_COUNT(&set)) {
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+#endif
+        current = node;
+    }
+
+    /* Pin the calling thread, the worker-th, to a core of its own. */
+    auto pin(const u32 worker) -> void {
+        const pair<u32, u32> & cpu = order()[worker % order().size()];
+        bind({ cpu.second }, cpu.first);
+    }
+
+    /* Let the calling thread run on any core of node. */
+    auto enter(const u32 node) -> void {
+        bind(nodes()[node], node);
+    }
+
+    /*
+     * The cores and node of the calling thread, given back to it when this
+     * goes out of scope, so a thread pinned for a while is let go again.
+     */
+    class Saved {
+
+        public:
+            u32 node;
+#ifdef _WIN32
+            DWORD_PTR mask;
+#elif defined(__linux__)
+            cpu_set_t set;
+#endif
+
+            Saved() : node(current) {
+#ifdef _WIN32
+                // Windows only tells a thread's mask when setting a new one
+                DWORD_PTR process = 0, system = 0;
+                GetProcessAffinityMask(GetCurrentProcess(), &process, &system);
+                mask = SetThreadAffinityMask(GetCurrentThread(), process);
+                SetThreadAffinityMask(GetCurrentThread(), mask);
+#elif defined(__linux__)
+                pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+            }
+
+            Saved(const Saved &) = delete;
+            auto operator=(const Saved &) -> Saved & = delete;
+
+            ~Saved() {
+#ifdef _WIN32
+                SetThreadAffinityMask(GetCurrentThread(), mask);
+#elif defined(__linux__)
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+                current = node;
+            }
+    };
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include "lib/core.hpp"
+#include "lib/util/memory.hpp"
+#include "lib/util/numa.hpp"
+
+using namespace std;
+
+namespace parallel {
+
+    /* Number of worker threads to use, never less than one. */
+    auto threads() -> u32 {
+        const u32 n = thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    /*
+     * Run fn(i) for every i in [0, count) across the worker threads. Work is
+     * handed out one index at a time from a shared counter so uneven items
+     * (rows with more geometry, expensive tiles) balance themselves. With
+     * --affinity every worker, including the calling thread, is pinned to
+     * a core of its own, spread evenly over the NUMA nodes. The calling
+     * thread gets its own cores back once the work is done, so serial work
+     * after it, and threads it starts later, are not stuck on one core.
+     * Going over --mem-limit stops handing out work, and fails once every
+     * worker has returned.
+     */
+    auto each(const u32 count, const function<void(u32)> & fn) -> void {
+
+        atomic<u32> next(0);
+        const u32 n = min(threads(), count);
+
+        auto worker = [&](const u32 t) {
+            if(numa::AFFINITY) {
+                numa::pin(t);
+            }
+            for(u32 i = next++; i < count && !memory::exceeded; i = next++) {
+                fn(i);
+            }
+        };
+
+        {
+            unique_ptr<numa::Saved> saved(numa::AFFINITY ? new numa::Saved() : nullptr);
+            memory::Sharing sharing;
+            vector<thread> pool;
+            for(u32 t = 1; t < n; t++) {
+                pool.push_back(thread(worker, t));
+            }
+            worker(0);
+            for(thread & t : pool) {
+                t.join();
+            }
+        }
+        memory::check();
+    }
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include "lib/core.hpp"
+#include "lib/util/memory.hpp"
+
+using namespace std;
+
+bool STATS = false;
+
+/*
+ * Render statistics. Every thread counts into its own Counters so the hot
+ * path never contends; the per thread counters are merged when reported,
+ * and into a running total when their thread exits so threads started
+ * later reuse them.
+ * All counting is behind a check of STATS so it costs a predictable branch
+ * when disabled.
+ */
+namespace stats {
+
+    /// Counter indices
+    const u32 PRIMARY   = 0;
+    const u32 SECONDARY = 1;
+    const u32 SHADOW    = 2;
+    const u32 SAMPLES   = 3;
+    const u32 PIXELS    = 4;
+    const u32 TILES     = 5;
+    const u32 SPHERE    = 6;
+    const u32 PLANE     = 7;
+    const u32 TRIANGLE  = 8;
+    const u32 QUAD      = 9;
+    const u32 RECORDS   = 10;
+    const u32 TEXTURE_TILES = 11;
+    const u32 SHADOW_REUSED = 12;
+    const u32 NODES     = 13;
+    const u32 COUNT     = 14;
+
+    const vector<string> NAMES = {
+        "primary", "secondary", "shadow",
+        "samples", "pixels", "tiles",
+        "sphere", "plane", "triangle", "quad",
+        "records", "texture_tiles", "shadow_reused", "nodes"
+    };
+
+    /// Timer indices
+    const u32 TRACE   = 0;
+    const u32 RENDER  = 1;
+    const u32 DENOISE = 2;
+    const u32 OUTPUT  = 3;
+    const u32 TIMERS  = 4;
+
+    /// Path depth histogram size, deeper paths land in the last bin
+    const u32 DEPTHS = 32;
+
+    class Counters {
+
+        public:
+            u64 counts[COUNT];
+            u64 depths[DEPTHS];
+            u64 nanos[TIMERS];
+
+            Counters() {
+                fill(counts, counts + COUNT,  u64(0));
+                fill(depths, depths + DEPTHS, u64(0));
+                fill(nanos,  nanos + TIMERS,  u64(0));
+            }
+
+            auto merge(const Counters & c) -> void {
+                for(u32 k = 0; k < COUNT;  k++) counts[k] += c.counts[k];
+                for(u32 k = 0; k < DEPTHS; k++) depths[k] += c.depths[k];
+                for(u32 k = 0; k < TIMERS; k++) nanos[k]  += c.nanos[k];
+            }
+    };
+
+    mutex lock;
+    deque<Counters> all;
+
+    /// Counts of threads that have exited, and their Counters ready for new threads
+    Counters retired;
+    vector<Counters *> spare;
+
+    /* A thread's Counters, folded into retired and given back when the thread exits. */
+    class Slot {
+
+        public:
+            Counters * counters = nullptr;
+
+            ~Slot() {
+                if(counters) {
+                    lock_guard<mutex> guard(lock);
+                    retired.merge(*counters);
+                    *counters = Counters();
+                    spare.push_back(counters);
+                }
+            }
+    };
+
+    thread_local Slot mine;
+
+    auto local() -> Counters & {
+        if(!mine.counters) {
+            lock_guard<mutex> guard(lock);
+            if(spare.empty()) {
+                all.push_back(Counters());
+                mine.counters = &all.back();
+            } else {
+                mine.counters = spare.back();
+                spare.pop_back();
+            }
+        }
+        return *mine.counters;
+    }
+
+    auto count(const u32 counter, const u64 n = 1) -> void {
+        if(STATS) {
+            local().counts[counter] += n;
+        }
+    }
+
+    /* Count a ray of the given path depth (1 for primary rays). */
+    auto ray(const u32 depth) -> void {
+        if(STATS) {
+            Counters & c = local();
+            c.counts[depth > 1 ? SECONDARY : PRIMARY]++;
+            c.depths[min(depth, DEPTHS - 1)]++;
+        }
+    }
+
+    /// Traversals a thread times for the trace phase, one in this many, to keep clock reads off the hot path
+    const u32 SAMPLE = 64;
+
+    thread_local u32 traversals = 0;
+
+    /* Nanoseconds a read of the clock takes, measured once, as it is about as long as a short traversal. */
+    auto overhead() -> u64 {
+        static const u64 nanos = []() {
+            const u32 reads = 1000;
+            const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(u32 k = 0; k < reads; k++) {
+                chrono::steady_clock::now();
+            }
+            return u64(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() / reads);
+        }();
+        return nanos;
+    }
+
+    /* Adds the lifetime of the timer to a phase when statistics are on. */
+    class Timer {
+
+        public:
+            const u32 phase;
+            const chrono::steady_clock::time_point start;
+
+            Timer(const u32 p) : phase(p), start(STATS ? chrono::steady_clock::now() : chrono::steady_clock::time_point()) {}
+
+            ~Timer() {
+                if(STATS) {
+                    local().nanos[phase] += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+                }
+            }
+    };
+
+    /*
+     * Adds SAMPLE times the lifetime of every SAMPLEth timer of a thread to
+     * a phase, less the time reading the clock takes, for steps too short
+     * and frequent to time every one of, like traversing the scene for one
+     * ray.
+     */
+    class Sampled {
+
+        public:
+            const u32 phase;
+            const bool timing;
+            const chrono::steady_clock::time_point start;
+
+            Sampled(const u32 p) :
+                phase(p),
+                timing(STATS && traversals++ % SAMPLE == 0),
+                start(timing ? chrono::steady_clock::now() : chrono::steady_clock::time_point())
+            {}
+
+            ~Sampled() {
+                if(timing) {
+                    const u64 nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+                    local().nanos[phase] += SAMPLE * (nanos > overhead() ? nanos - overhead() : 0);
+                }
+            }
+    };
+
+    auto merged() -> Counters {
+        lock_guard<mutex> guard(lock);
+        Counters total = retired;
+        for(const Counters & c : all) {
+            total.merge(c);
+        }
+        return total;
+    }
+
+    auto seconds(const u64 nanos) -> f64 {
+        return f64(nanos) / 1e9;
+    }
+
+    /*
+     * Report merged statistics as text or json. Times are thread seconds,
+     * summed over all threads, and shading is rendering time not spent
+     * tracing. Memory use per subsystem follows.
+     */
+    auto report(const string & format) -> string {
+
+        const Counters c = merged();
+        const u64 shade  = c.nanos[RENDER] > c.nanos[TRACE] ? c.nanos[RENDER] - c.nanos[TRACE] : 0;
+        const f64 spp    = c.counts[PIXELS] ? f64(c.counts[SAMPLES]) / f64(c.counts[PIXELS]) : 0;
+
+        u32 deepest = 0;
+        for(u32 d = 0; d < DEPTHS; d++) {
+            if(c.depths[d]) {
+                deepest = d;
+            }
+        }
+
+        stringstream stream;
+
+        if(equal(format, "json")) {
+            stream << "{";
+            for(u32 k = 0; k < COUNT; k++) {
+                stream << "\"" << NAMES[k] << "\": " << c.counts[k] << ", ";
+            }
+            stream << "\"samples_per_pixel\": " << spp << ", \"depths\": [";
+            for(u32 d = 1; d <= deepest; d++) {
+                stream << c.depths[d] << (d < deepest ? ", " : "");
+            }
+            stream << "], \"seconds\": {"
+                << "\"trace\": "   << seconds(c.nanos[TRACE])   << ", "
+                << "\"shade\": "   << seconds(shade)            << ", "
+                << "\"denoise\": " << seconds(c.nanos[DENOISE]) << ", "
+                << "\"output\": "  << seconds(c.nanos[OUTPUT])  << "}, "
+                << "\"memory\": "  << memory::report(format) << "}";
+            return stream.str();
+        }
+
+        stream << "[Statistics]" << endl;
+        for(u32 k = 0; k < COUNT; k++) {
+            stream << " " << left << setw(18) << (toupper(NAMES[k]) + ":") << c.counts[k] << endl;
+        }
+        stream << " " << left << setw(18) << "SPP:" << spp << endl;
+        for(u32 d = 1; d <= deepest; d++) {
+            stream << " " << left << setw(18) << ("DEPTH " + to_string(d) + ":") << c.depths[d] << endl;
+        }
+        stream << " " << left << setw(18) << "TRACE (s):"   << seconds(c.nanos[TRACE])   << endl
+               << " " << left << setw(18) << "SHADE (s):"   << seconds(shade)            << endl
+               << " " << left << setw(18) << "DENOISE (s):" << seconds(c.nanos[DENOISE]) << endl
+               << " " << left << setw(18) << "OUTPUT (s):"  << seconds(c.nanos[OUTPUT])  << endl
+               << endl << memory::report(format);
+        return stream.str();
+    }
+}
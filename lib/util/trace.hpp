@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "lib/core.hpp"
+
+using namespace std;
+
+bool TRACING = false;
+
+/*
+ * Timeline tracing in the Chrome trace event format, viewable in
+ * chrome://tracing or Perfetto. Spans are recorded into per thread event
+ * lists, like the stats counters, and written out once rendering is done.
+ */
+namespace trace {
+
+    class Event {
+        public:
+            string name;
+            string args;
+            u64 start;
+            u64 duration;
+    };
+
+    class Thread {
+        public:
+            u32 id;
+            string name;
+            vector<Event> events;
+    };
+
+    const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+    /// Static initialization runs on the main thread
+    const thread::id mainThread = this_thread::get_id();
+
+    mutex lock;
+    deque<Thread> threads;
+    vector<Thread *> spare;
+
+    /*
+     * A thread's lane, given back when the thread exits so the workers
+     * parallel::each starts for every frame reuse the lanes of the last
+     * ones instead of adding new ones.
+     */
+    class Lane {
+        public:
+            Thread * thread = nullptr;
+
+            ~Lane() {
+                if(thread) {
+                    lock_guard<mutex> guard(lock);
+                    spare.push_back(thread);
+                }
+            }
+    };
+
+    thread_local Lane mine;
+
+    auto local() -> Thread & {
+        if(!mine.thread) {
+            lock_guard<mutex> guard(lock);
+            const bool main = this_thread::get_id() == mainThread;
+            if(main || spare.empty()) {
+                const u32 id = threads.size();
+                threads.push_back(Thread { id, main ? "main" : "worker " + to_string(id), vector<Event>() });
+                mine.thread = &threads.back();
+            } else {
+                mine.thread = spare.back();
+                spare.pop_back();
+            }
+        }
+        return *mine.thread;
+    }
+
+    /* Microseconds since the program started. */
+    auto now() -> u64 {
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - epoch).count();
+    }
+
+    /* Records its lifetime as a complete event when tracing is on. */
+    class Span {
+
+        public:
+            const string name;
+            const string args;
+            const u64 start;
+
+            Span(const string & n, const string & a = "") : name(TRACING ? n : ""), args(TRACING ? a : ""), start(TRACING ? now() : 0) {}
+
+            ~Span() {
+                if(TRACING) {
+                    local().events.push_back(Event { name, args, start, now() - start });
+                }
+            }
+    };
+
+    auto write(const string & path) -> void {
+
+        lock_guard<mutex> guard(lock);
+        ofstream fs(path);
+        bool first = true;
+
+        fs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+        for(const Thread & t : threads) {
+            fs << (first ? "" : ",\n")
+               << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t.id
+               << ", \"args\": {\"name\": \"" << t.name << "\"}}";
+            first = false;
+
+            for(const Event & e : t.events) {
+                fs << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t.id
+                   << ", \"ts\": " << e.start << ", \"dur\": " << e.duration
+                   << ", \"args\": {" << e.args << "}}";
+            }
+        }
+        fs << endl << "]}" << endl;
+    }
+}
@@ -28,9 +28,12 @@ namespace valid {
         };
     }
 
-    auto scene(Scene & scene) -> Validator {
+    auto scene(string & name) -> Validator {
         return [&](i32 n, const char** args) mutable -> i32 {
-            scene = scene::get(string(args[n]));
+            name = string(args[n]);
+            if(!scene::exists(name)) {
+                fail(name + " is not a valid scene name.");
+            }
             return 1;
         };
     }
@@ -42,6 +45,124 @@ namespace valid {
         };
     }
 
+    auto aov(vector<string> & names) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            stringstream stream(args[n]);
+            string name;
+            while(getline(stream, name, ',')) {
+                if(aov::index(name) == aov::COUNT) {
+                    fail(name + " is not a valid AOV.");
+                }
+                names.push_back(name);
+            }
+            return 1;
+        };
+    }
+
+    auto stats(string & format) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            format = string(args[n]);
+            if(!equal(format, "text") && !equal(format, "json")) {
+                fail(format + " is not a valid statistics format.");
+            }
+            STATS = true;
+            return 1;
+        };
+    }
+
+    auto trace(string & path) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            path = string(args[n]);
+            TRACING = true;
+            return 1;
+        };
+    }
+
+    auto seed(u32 & seed) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            seed = stoi(string(args[n]));
+            return 1;
+        };
+    }
+
+    auto passes(u32 & passes) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            passes = stoi(string(args[n]));
+            if(passes == 0) {
+                fail(string(args[n]) + " is not a valid number of passes.");
+            }
+            return 1;
+        };
+    }
+
+    auto milliseconds(f64 & seconds) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            seconds = stof(string(args[n])) / 1000;
+            if(seconds <= 0) {
+                fail(string(args[n]) + " is not a valid number of milliseconds.");
+            }
+            return 1;
+        };
+    }
+
+    auto megabytes(usize & bytes) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            const f64 mb = stof(string(args[n]));
+            if(mb <= 0) {
+                fail(string(args[n]) + " is not a valid number of megabytes.");
+            }
+            bytes = mb * (1 << 20);
+            return 1;
+        };
+    }
+
+    auto region(Tile & region) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            const string s = string(args[n]);
+            regex rgx(R"((\d+),(\d+),(\d+),(\d+))");
+            smatch matches;
+
+            if(!std::regex_search(s, matches, rgx)) {
+                fail(s + " is not a valid region.");
+            }
+            region = Tile(stoi(matches[1]), stoi(matches[2]), stoi(matches[3]), stoi(matches[4]));
+            if(region.x0 >= region.x1 || region.y0 >= region.y1) {
+                fail(s + " is not a valid region.");
+            }
+            return 1;
+        };
+    }
+
+    auto shard(u32 & shard, u32 & shards) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            const string s = string(args[n]);
+            regex rgx(R"((\d+)/(\d+))");
+            smatch matches;
+
+            if(!std::regex_search(s, matches, rgx)) {
+                fail(s + " is not a valid shard.");
+            }
+            shard  = stoi(matches[1]);
+            shards = stoi(matches[2]);
+            if(shards == 0 || shard >= shards) {
+                fail(s + " is not a valid shard.");
+            }
+            return 1;
+        };
+    }
+
+    /* Takes every argument up to the next option. */
+    auto paths(vector<string> & paths) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            i32 taken = 0;
+            while(args[n + taken] && args[n + taken][0] != '-') {
+                paths.push_back(string(args[n + taken]));
+                taken++;
+            }
+            return taken;
+        };
+    }
+
     auto fov(f32 & fov) -> Validator {
         return [&](i32 n, const char** args) mutable -> i32 {
             fov = stof(string(args[n]));
@@ -63,6 +184,22 @@ namespace valid {
         };
     }
 
+    auto targets(vector<resample::Target> & targets) -> Validator {
+        return [&](i32 n, const char** args) mutable -> i32 {
+            stringstream stream(args[n]);
+            string target;
+            regex rgx(R"(^(\d+)x(\d+):(.+)$)");
+            smatch matches;
+            while(getline(stream, target, ',')) {
+                if(!std::regex_search(target, matches, rgx) || stoi(string(matches[1])) == 0 || stoi(string(matches[2])) == 0) {
+                    fail(target + " is not a valid widthxheight:path.");
+                }
+                targets.push_back(resample::Target { Resolution(stoi(string(matches[1])), stoi(string(matches[2]))), matches[3] });
+            }
+            return 1;
+        };
+    }
+
     auto res(Resolution & res) -> Validator {
         return [&](i32 n, const char** args) mutable -> i32 {
             const string s = string(args[n]);
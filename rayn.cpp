@@ -1,42 +1,127 @@
 #include "lib/core.hpp"
 #include "lib/data/buffer.hpp"
+#include "lib/data/floatbuffer.hpp"
 #include "lib/data/resolution.hpp"
 #include "lib/data/cameraview.hpp"
 #include "lib/data/scene.hpp"
+#include "lib/data/aov.hpp"
 #include "lib/render/shader.hpp"
 #include "lib/render/aa.hpp"
+#include "lib/render/render.hpp"
+#include "lib/render/denoise.hpp"
+#include "lib/render/interactive.hpp"
+#include "lib/render/resample.hpp"
 #include "lib/util/argparser.hpp"
+#include "lib/util/memory.hpp"
 #include "lib/util/validators.hpp"
 
 using namespace std;
 
-auto render(
-    const Resolution & res,
-    const Camera & camera,
-    const Scene & scene,
-    const Shader & shader,
-    const AA & aa
-) -> const Buffer {
-    Buffer buffer(res.width, res.height);
-    buffer.map(aa.sample(camera, scene, shader));
-    return buffer;
+/*
+ * rayn merge: assemble the partial renders written with --region or
+ * --shard into the final image.
+ */
+auto merge(const i32 argc, const i8 * argv[]) -> i32 {
+
+    string format = "bmp";
+    string out    = "render.bmp";
+    vector<string> parts;
+    vector<string> outputs;
+    vector<resample::Target> targets;
+    bool denoised = false;
+
+    ArgParser parser("rayn merge", "Assemble partial renders into one image\n");
+    parser.arg(valid::format(format), "--format",  "-f", "output format (bmp or ppm)");
+    parser.arg(valid::out(out),       "--out",     "-o", "output file path");
+    parser.arg(valid::paths(parts),   "--parts",   "-i", "partial render files");
+    parser.arg(valid::aov(outputs),   "--aov",     "-A", "also output AOVs (depth, normal, albedo, id)");
+    parser.arg(valid::targets(targets), "--also-out", "-O", "also output resized copies, widthxheight:path,...");
+    parser.opt(denoised,              "--denoise", "-D", "denoise the merged image before output");
+    parser.opt(DEBUG,                 "--debug",   "-d", "enable debug messages");
+    parser.parse(argc, argv);
+
+    FloatBuffer image;
+    AOVs aovs;
+    checkpoint::merge(parts, image, aovs);
+    debug << "Merged " << parts.size() << " parts into " << image.width << "x" << image.height << endl;
+
+    if(denoised) {
+        for(const string & guide : denoise::GUIDES) {
+            if(!aovs.enabled(aov::index(guide))) {
+                fail("Denoising needs parts rendered with --denoise.");
+            }
+        }
+        image = denoise::filter(image, aovs);
+    }
+    image.out(format, out);
+    aovs.out(outputs, format, out);
+    resample::out(image, targets, format);
+    return 0;
+}
+
+/*
+ * rayn texture: convert an image into a tiled, mip-mapped texture file
+ * for scenes to stream from.
+ */
+auto convert(const i32 argc, const i8 * argv[]) -> i32 {
+
+    string image;
+    string out = "texture.tex";
+
+    ArgParser parser("rayn texture", "Convert a 24-bit bmp into a texture\n");
+    parser.arg(valid::out(image), "--image", "-i", "bmp image to convert");
+    parser.arg(valid::out(out),   "--out",   "-o", "texture file path");
+    parser.opt(DEBUG,             "--debug", "-d", "enable debug messages");
+    parser.parse(argc, argv);
+
+    if(image.empty()) {
+        fail("rayn texture requires --image.");
+    }
+    const Buffer buffer = buffer::bmp(image);
+    texture::convert(buffer, out);
+    debug << "Converted " << buffer.width << "x" << buffer.height << " " << image << " into " << out
+        << " with " << Texture(out).levels.size() << " levels" << endl;
+    return 0;
 }
 
 auto main(const i32 argc, const i8 * argv[]) -> i32 {
 
+    if(argc > 1 && equal(argv[1], "merge")) {
+        return merge(argc - 1, argv + 1);
+    }
+    if(argc > 1 && equal(argv[1], "texture")) {
+        return convert(argc - 1, argv + 1);
+    }
+
     Buffer buffer;
 
     /// Default Values
     string format      = "bmp";
     string out         = "render.bmp";
     Shader shader      = shader::normal;
-    Scene scene        = scene::scene1;
+    string sceneName   = "scene1";
     AA aa              = aa::none;
     f32 fov            = 90;
     CameraView camView = CameraView(Vec(0,0,0), Vec(0,0,-1), Vec(0,1,0));
     Resolution res     = Resolution(1000, 500);
 
+    vector<string> outputs;
+    vector<resample::Target> targets;
+    string statsFormat = "text";
+    string tracePath;
+    string checkpointPath;
+    string gbufferDir;
+    string framebufferPath;
+    f64 frameTime = 1.0 / 30;
+    u32 passes = 1;
+    Tile region;
+    u32 shard  = 0;
+    u32 shards = 1;
+
     bool preview = false;
+    bool denoised = false;
+    bool resume = false;
+    bool rasterize = false;
 
     /// Command Line Arguments
     ArgParser parser("rayn", R"(
@@ -51,39 +136,195 @@ auto main(const i32 argc, const i8 * argv[]) -> i32 {
 
     parser.arg(valid::format(format),  "--format",     "-f", "output format (bmp or ppm)");
     parser.arg(valid::out(out),        "--out",        "-o", "output file path");
-    parser.arg(valid::shader(shader),  "--shader",     "-s", "select shader (normal, scatter, phong)");
-    parser.arg(valid::scene(scene),    "--scene",      "-S", "select scene");
+    parser.arg(valid::shader(shader),  "--shader",     "-s", "select shader (normal, scatter, phong, irradiance, guided)");
+    parser.arg(valid::scene(sceneName),    "--scene",      "-S", "select scene");
     parser.arg(valid::aa(aa),          "--aa",         "-a", "select anti aliasing method (none, centered, SSAA)");
     parser.arg(valid::fov(fov),        "--fov",        "-v", "set the vertical FOV in degrees");
     parser.arg(valid::camera(camView), "--camera",     "-c", "set camera position, angle, up");
     parser.arg(valid::res(res),        "--resolution", "-r", "set resolution widthxheight");
+    parser.arg(valid::aov(outputs),    "--aov",        "-A", "also output AOVs (depth, normal, albedo, id)");
+    parser.arg(valid::targets(targets), "--also-out",  "-O", "also output resized copies, widthxheight:path,...");
     parser.opt(preview,                "--preview",    "-p", "enable preview images");
+    parser.opt(denoised,               "--denoise",    "-D", "denoise the render before output");
+    parser.arg(valid::passes(passes),  "--passes",     "-P", "average this many progressive passes");
+    parser.arg(valid::out(checkpointPath), "--checkpoint", "-k", "periodically save progress to path");
+    parser.opt(resume,                 "--resume",     "-R", "resume from the checkpoint if there is one");
+    parser.arg(valid::region(region),  "--region",     "-g", "only render pixels x0,y0,x1,y1 to a partial file");
+    parser.arg(valid::shard(shard, shards), "--shard", "-x", "only render shard i/n of the tiles to a partial file");
+    parser.arg(valid::out(gbufferDir), "--gbuffer",    "-G", "cache primary visibility in directory");
+    parser.opt(rasterize,              "--raster",     "-z", "rasterize primary visibility of flat bodies");
+    parser.arg(valid::out(framebufferPath), "--interactive", "-I", "render camera updates from stdin into a shared framebuffer");
+    parser.arg(valid::milliseconds(frameTime), "--frame-time", "-F", "target milliseconds per interactive frame");
+    parser.opt(shadow::REUSE,          "--shadow-cache", "-w", "reuse shadow rays between samples of a pixel");
+    parser.opt(numa::AFFINITY,         "--affinity",   "-y", "pin threads to cores spread over NUMA nodes");
+    parser.opt(numa::REPLICATE,        "--replicate",  "-Y", "build a copy of the scene on every NUMA node");
+    parser.arg(valid::megabytes(texture::BUDGET), "--texture-cache", "-C", "keep up to this many MB of texture tiles in memory");
+    parser.arg(valid::megabytes(memory::LIMIT), "--mem-limit", "-M", "fail once tracked memory exceeds this many MB");
+    parser.arg(valid::stats(statsFormat), "--stats",    "-t", "report render statistics (text or json)");
+    parser.arg(valid::seed(rng::SEED), "--seed",       "-e", "set the random seed");
+    parser.arg(valid::trace(tracePath), "--trace",     "-T", "write a chrome trace of the render to path");
     parser.opt(DEBUG,                  "--debug",      "-d", "enable debug messages");
     parser.parse(argc, argv);
 
+    if(resume && checkpointPath.empty()) {
+        fail("--resume requires --checkpoint.");
+    }
+
+    // Partial renders are written out whole for rayn merge to assemble
+    const bool partial = region.pixels() > 0 || shards > 1;
+    if(region.pixels() == 0) {
+        region = Tile(0, 0, res.width, res.height);
+    }
+
     debug << "Running ray tracer in debug mode..." << endl
         << endl << "[Configuration]"
         << endl << " FORMAT:   " << format
         << endl << " OUTPUT:   " << out
         << endl << " SHADER:   " << shader.name
-        << endl << " SCENE:    " << scene.name
+        << endl << " SCENE:    " << sceneName
         << endl << " AA:       " << aa.name
         << endl << " FOV:      " << fov
         << endl << " POSITION: " << vec::str(camView.from)
         << endl << " TOWARDS:  " << vec::str(camView.to)
         << endl << " VUP:      " << vec::str(camView.vup)
         << endl << " RES:      " << res.width << "x" << res.height
+        << endl << " AOVS:     " << outputs.size()
+        << endl << " SIZES:    " << targets.size() + 1
+        << endl << " DENOISE:  " << (denoised ? "on" : "off")
+        << endl << " PASSES:   " << passes
+        << endl << " REGION:   " << region.x0 << "," << region.y0 << "," << region.x1 << "," << region.y1
+        << endl << " SHARD:    " << shard << "/" << shards
+        << endl << " RASTER:   " << (rasterize ? "on" : "off")
+        << endl << " SHADOWS:  " << (shadow::REUSE ? "reused" : "traced")
+        << endl << " TEXTURES: " << (texture::BUDGET >> 20) << "MB"
+        << endl << " MEMORY:   " << (memory::LIMIT ? to_string(memory::LIMIT >> 20) + "MB" : "unlimited")
+        << endl << " NUMA:     " << numa::nodes().size() << " node(s)"
+            << (numa::AFFINITY || numa::REPLICATE ? ", pinned" : "") << (numa::REPLICATE ? ", replicated" : "")
         << endl;
 
+    shared_ptr<const Scene> scene;
+    {
+        trace::Span span("scene build");
+        scene = scene::get(sceneName);
+    }
+    if(numa::REPLICATE) {
+        numa::AFFINITY = true;
+        trace::Span span("scene replicate");
+        scene::replicate(sceneName);
+    }
+
+    if(!framebufferPath.empty()) {
+        interactive::run(framebufferPath, res, camView, fov, *scene, shader, aa, passes, frameTime, rasterize);
+        if(TRACING) {
+            trace::write(tracePath);
+        }
+        return 0;
+    }
+
     Camera camera = camView.camera(fov, res.aspect);
+    unique_ptr<const Raster> raster;
+    if(rasterize) {
+        raster.reset(new Raster(camera, *scene));
+    }
+
+    // Primary visibility only depends on the scene geometry and the view
+    const string view = scene->name + " " + scene->fingerprint() + " " + to_string(fov) + " "
+        + vec::str(camView.from) + vec::str(camView.to) + vec::str(camView.vup) + " " + to_string(rng::SEED);
+
+    CostMap costs;
 
     if(preview) {
         debug << endl << "[Previewing]" << endl;
-        render(Resolution(res.aspect * 100, 100), camera, scene, shader, aa::none).out(format, "preview." + format);
+        trace::Span span("preview");
+        const Resolution small(res.aspect * 100, 100);
+        unique_ptr<GBuffer> primary;
+        if(!gbufferDir.empty()) {
+            primary.reset(new GBuffer(view + " " + to_string(small.width) + "x" + to_string(small.height) + " " + aa::none.name + " 1",
+                small.width, small.height, aa::none.samples, 1));
+            primary->load(gbufferDir);
+        }
+        ::preview(small, camera, *scene, shader, costs, primary.get(), raster.get()).out(format, "preview." + format);
+        if(!gbufferDir.empty()) {
+            primary->save(gbufferDir);
+        }
         debug << endl;
     }
 
+    AOVs aovs(outputs, res.width, res.height);
+    if(denoised) {
+        for(const string & guide : denoise::GUIDES) {
+            aovs.enable(guide, res.width, res.height);
+        }
+    }
+
+    Checkpoint progress(
+        checkpointPath,
+        scene->name + " " + shader.name + " " + aa.name + " " + to_string(fov) + " "
+            + vec::str(camView.from) + vec::str(camView.to) + vec::str(camView.vup) + " " + to_string(rng::SEED)
+            + " " + to_string(region.x0) + "," + to_string(region.y0) + "," + to_string(region.x1) + "," + to_string(region.y1)
+            + " " + to_string(shard) + "/" + to_string(shards),
+        res.width,
+        res.height,
+        passes,
+        schedule::plan(tile::shard(tile::clip(tile::split(res.width, res.height), region), shard, shards), res.width, res.height, costs),
+        aovs
+    );
+    if(resume && progress.load()) {
+        debug << "Resuming at pass " << progress.pass + 1 << " of " << passes << " with "
+            << progress.tiles.size() - progress.todo().size() << " of " << progress.tiles.size() << " tiles done" << endl;
+    }
+
+    unique_ptr<GBuffer> primary;
+    if(!gbufferDir.empty()) {
+        primary.reset(new GBuffer(view + " " + to_string(res.width) + "x" + to_string(res.height) + " " + aa.name + " " + to_string(passes),
+            res.width, res.height, aa.samples, passes));
+        if(primary->load(gbufferDir)) {
+            debug << "Reusing " << primary->known << " of " << primary->hits.size() << " primary hits from " << primary->path(gbufferDir) << endl;
+        }
+    }
+
     debug << endl << "[Rendering]" << endl;
-    render(res, camera, scene, shader, aa).out(format, out);
+    FloatBuffer image;
+    {
+        trace::Span span("render");
+        image = render(camera, *scene, shader, aa, aovs, progress, primary.get(), raster.get());
+    }
     debug << endl;
+
+    if(!gbufferDir.empty()) {
+        primary->save(gbufferDir);
+    }
+
+    if(partial) {
+        trace::Span span("encode");
+        stats::Timer timer(stats::OUTPUT);
+        progress.aovs = aovs;
+        progress.save(out);
+    }
+    else if(denoised) {
+        debug << endl << "[Denoising]" << endl;
+        trace::Span span("denoise");
+        stats::Timer timer(stats::DENOISE);
+        image = denoise::filter(image, aovs);
+    }
+    if(!partial) {
+        trace::Span span("encode");
+        stats::Timer timer(stats::OUTPUT);
+        image.out(format, out);
+        aovs.out(outputs, format, out);
+    }
+    if(!partial && !targets.empty()) {
+        trace::Span span("resample");
+        stats::Timer timer(stats::OUTPUT);
+        resample::out(image, targets, format);
+    }
+    progress.clear();
+    if(STATS) {
+        cout << stats::report(statsFormat) << endl;
+    } else {
+        debug << endl << memory::report("text") << endl;
+    }
+    if(TRACING) {
+        trace::write(tracePath);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "lib/core.hpp"
+#include "lib/data/buffer.hpp"
+#include "lib/data/floatbuffer.hpp"
+#include "lib/data/resolution.hpp"
+#include "lib/data/cameraview.hpp"
+#include "lib/data/scene.hpp"
+#include "lib/data/aov.hpp"
+#include "lib/render/shader.hpp"
+#include "lib/render/aa.hpp"
+#include "lib/render/render.hpp"
+#include "lib/render/resample.hpp"
+#include "lib/util/argparser.hpp"
+#include "lib/util/validators.hpp"
+#include "lib/util/bench.hpp"
+
+#include <map>
+
+using namespace std;
+
+/*
+ * Regression harness. Renders every registered scene with a fixed seed and
+ * compares it to a golden image in golden/, failing when the PSNR drops
+ * below a tolerance or the render gets slower than the recorded baseline
+ * time by more than a threshold. Run with --bless to (re)write the golden
+ * images and baseline times after an intended change.
+ */
+namespace regress {
+
+    const string DIR     = "golden/";
+    const string TIMINGS = DIR + "timings.txt";
+
+    auto psnr(const Buffer & a, const Buffer & b) -> f64 {
+
+        if(a.width != b.width || a.height != b.height) {
+            return 0;
+        }
+        f64 mse = 0;
+        for(usize p = 0; p < a.data.size(); p++) {
+            const f64 dr = f64(a.data[p].r) - f64(b.data[p].r);
+            const f64 dg = f64(a.data[p].g) - f64(b.data[p].g);
+            const f64 db = f64(a.data[p].b) - f64(b.data[p].b);
+            mse += dr * dr + dg * dg + db * db;
+        }
+        mse /= 3.0 * a.data.size();
+        return mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    }
+
+    auto timings() -> map<string, f64> {
+        map<string, f64> times;
+        ifstream fs(TIMINGS);
+        string name;
+        f64 seconds;
+        while(fs >> name >> seconds) {
+            times[name] = seconds;
+        }
+        return times;
+    }
+
+    auto save(const map<string, f64> & times) -> void {
+        ofstream fs(TIMINGS);
+        for(const pair<const string, f64> & t : times) {
+            fs << t.first << " " << t.second << endl;
+        }
+    }
+}
+
+auto main(const i32 argc, const i8 * argv[]) -> i32 {
+
+    bool bless     = false;
+    f32 tolerance  = 40;
+    f32 slowdown   = 0.25;
+    Resolution res = Resolution(200, 100);
+    Shader shader  = shader::phong;
+    AA aa          = aa::SSAAx4;
+
+    ArgParser parser("rayn-regress", "Render every scene and compare against golden images\n");
+    parser.arg([&](i32 n, const char** args) -> i32 {
+        tolerance = stof(string(args[n]));
+        return 1;
+    }, "--psnr", "-P", "minimum PSNR in dB (default 40)");
+    parser.arg([&](i32 n, const char** args) -> i32 {
+        slowdown = stof(string(args[n]));
+        return 1;
+    }, "--slowdown", "-l", "allowed slowdown over baseline (default 0.25)");
+    parser.arg(valid::seed(rng::SEED), "--seed",  "-e", "set the random seed");
+    parser.opt(bless,                  "--bless", "-b", "write golden images and baseline times");
+    parser.parse(argc, argv);
+
+    const CameraView view(Vec(0,0,0), Vec(0,0,-1), Vec(0,1,0));
+    const Camera camera = view.camera(90, res.aspect);
+
+    map<string, f64> times = regress::timings();
+    u32 failures = 0;
+
+    for(const string & name : scene::names()) {
+
+        const Scene & scene = *scene::get(name);
+        const string golden = regress::DIR + scene.name + ".bmp";
+
+        FloatBuffer image;
+        auto op = [&]() {
+            AOVs aovs;
+            image = render(res, camera, scene, shader, aa, aovs);
+        };
+        const u64 rays = bench::traced(op);
+        const bench::Result r = bench::run(scene.name, [&](u64 iterations) -> u64 {
+            for(u64 n = 0; n < iterations; n++) {
+                op();
+            }
+            return rays * iterations;
+        });
+        const f64 seconds = r.seconds / r.iterations;
+        const Buffer out  = image.buffer();
+
+        if(bless) {
+            out.bmp(golden);
+            times[scene.name] = seconds;
+            cout << "BLESS " << scene.name << " " << seconds << "s" << endl;
+            continue;
+        }
+
+        const f64 db       = regress::psnr(out, buffer::bmp(golden));
+        const bool similar = db >= tolerance;
+        const bool fast    = !times.count(scene.name) || seconds <= times[scene.name] * (1 + slowdown);
+
+        failures += !(similar && fast);
+
+        cout << (similar && fast ? "PASS " : "FAIL ") << left << setw(20) << scene.name
+            << " psnr " << setw(10) << db << "dB"
+            << " time " << setw(10) << seconds << "s"
+            << " baseline " << setw(10) << (times.count(scene.name) ? to_string(times[scene.name]) + "s" : "none")
+            << " " << f64(r.rays) / r.seconds / 1e6 << " Mrays/s" << endl;
+    }
+
+    if(bless) {
+        regress::save(times);
+    }
+    if(failures) {
+        fail(to_string(failures) + " regression(s) found.");
+    }
+}